@@ -45,6 +45,10 @@ int pri_eval_decision_tree(e_role role, char* address, uint16_t port, seclvl sec
 	for (uint16_t i = 0;i < m_numNodes;i++) permutation[i] = i;
 	random_shuffle(permutation + 1, permutation + m_numNodes ); //permutation[0] = 0 */
 
+	// ----- comparison of every decision node, repeated comparisons are fanned out ----------
+	vector<uint32_t> cmpIndex(m_numNodes);
+	for (uint16_t i = 0;i < m_numNodes;i++) cmpIndex[i] = tree.cmp_index.size() == m_numNodes ? tree.cmp_index[i] : i;
+
 	//----------- generate a random feature vector ----------------
 	vector<uint64_t> m_vFeatureVec;
 
@@ -75,13 +79,13 @@ int pri_eval_decision_tree(e_role role, char* address, uint16_t port, seclvl sec
 		case SEL_HE:
 		{
 			cout << "**Runing oblivious selection subprotocol (homomorphic encryption)..." << endl;
-			selction_HE(role, netConnection->commChannel, m_vFeatureVec, seclvl, numNodes, permutation, cmpCirc, m_shrCircOutput);
+			selction_HE(role, netConnection->commChannel, m_vFeatureVec, seclvl, numNodes, permutation, cmpIndex, cmpCirc, m_shrCircOutput);
 		}
 		break;
 		case SEL_GC:
 		{
 		    cout << "**Runing oblivious selection subprotocol (garbled circuit)..." << endl;
-			selction_GC(m_vFeatureVec, m_numNodes, permutation, cmpCirc, m_shrCircOutput);
+			selction_GC(m_vFeatureVec, m_numNodes, permutation, cmpIndex, cmpCirc, m_shrCircOutput);
 		}
 		break;
 	}
@@ -39,9 +39,9 @@ enum e_sel_alg{ SEL_HE = 0, SEL_GC = 1};
 enum e_eval_alg{ EVAL_HE = 0, EVAL_GC = 1};
 enum e_HE_crypto_party { e_DGK = 0, e_PAILLIER = 1};
 
-void selction_HE(e_role role, channel* channel, vector<uint64_t> &featureVec, seclvl seclvl, uint64_t NumDecisionNodes, uint16_t* permutation, BooleanCircuit* &Circ, share** &CircOut);
+void selction_HE(e_role role, channel* channel, vector<uint64_t> &featureVec, seclvl seclvl, uint64_t NumDecisionNodes, uint16_t* permutation, vector<uint32_t> &cmpIndex, BooleanCircuit* &Circ, share** &CircOut);
 
-void selction_GC(vector<uint64_t> &featureVec, uint64_t numDecisionNodes, uint16_t* permutation, BooleanCircuit* &Circ, share** &CircOut);
+void selction_GC(vector<uint64_t> &featureVec, uint64_t numDecisionNodes, uint16_t* permutation, vector<uint32_t> &cmpIndex, BooleanCircuit* &Circ, share** &CircOut);
 
 int pri_eval_decision_tree(e_role role, char* address, uint16_t port, seclvl seclvl, uint32_t nthreads, e_mt_gen_alg mt_alg, e_sharing comparesharing, e_sel_alg sel_alg, uint64_t numNodes, uint64_t dimension, DecTree &tree);
 
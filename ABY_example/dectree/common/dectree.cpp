@@ -55,6 +55,7 @@ DecTree::DecTree()
     depth = 0;
     num_of_leaves = 0;
     dummy_non_full = 0;
+    num_cmps = 0;
 }
 
 DecTree::DecTree(const DecTree& other){
@@ -67,6 +68,10 @@ DecTree::DecTree(const DecTree& other){
     depth = other.depth;
     num_of_leaves = other.num_of_leaves;
     dummy_non_full = other.dummy_non_full;
+    num_cmps = other.num_cmps;
+    cmp_attributes = other.cmp_attributes;
+    cmp_thresholds = other.cmp_thresholds;
+    cmp_index = other.cmp_index;
 }
 
 /**
@@ -165,6 +170,9 @@ void DecTree::read_from_file(string string_file){
     float thres;
     while (getline(file, line)){
         tokenize(line, tokens);
+        if(tokens.size() < 3){ //e.g. the closing brace
+            continue;
+        }
         if(tokens[1] == "label=\"gini"){
             node1 = atoi(tokens[0].c_str());
             this->add_node(new DecTree::Node());
@@ -297,6 +305,32 @@ void DecTree::depthPad(){
     //cout << "Number of decision nodes " << this->num_dec_nodes << endl;
 }
 
+/**
+ * Finds the distinct (attribute, threshold) comparisons of the decision nodes, so that each of them
+ * is evaluated once and its result is used by all decision nodes that test it.
+ * Call after the tree is complete, i.e., after depthPad() or fullTree() if used.
+ * @param merge if false, every decision node gets a comparison of its own
+ */
+void DecTree::compile(bool merge){
+    map<pair<uint32_t, uint64_t>, uint32_t> index_of;
+    this->cmp_attributes.clear();
+    this->cmp_thresholds.clear();
+    this->cmp_index.resize(this->decnode_vec.size());
+    for(uint32_t i = 0; i < this->decnode_vec.size(); ++i){
+        pair<uint32_t, uint64_t> cmp(this->decnode_vec[i]->attribute_index, this->decnode_vec[i]->threshold);
+        map<pair<uint32_t, uint64_t>, uint32_t>::iterator it = index_of.find(cmp);
+        if(merge && it != index_of.end()){
+            this->cmp_index[i] = it->second;
+            continue;
+        }
+        this->cmp_index[i] = this->cmp_attributes.size();
+        index_of[cmp] = this->cmp_index[i];
+        this->cmp_attributes.push_back(cmp.first);
+        this->cmp_thresholds.push_back(cmp.second);
+    }
+    this->num_cmps = this->cmp_attributes.size();
+}
+
 void DecTree::evaluate(vector<uint64_t> inputs){
     DecTree::Node* this_node = this->node_vec[0];
     while(!(this_node->leaf)){
@@ -31,6 +31,7 @@
 #include <algorithm>
 #include <stdint.h>
 #include <math.h>       /* pow */
+#include <map>
 
 using namespace std;
 
@@ -79,6 +80,15 @@ class DecTree {
    //dummy in our case
    uint32_t dummy_non_full;
 
+   //COMPILED COMPARISONS, filled by compile()
+   //number of distinct comparisons
+   uint32_t num_cmps;
+   //attribute index and threshold of every distinct comparison
+   vector<uint32_t> cmp_attributes;
+   vector<uint64_t> cmp_thresholds;
+   //index of the comparison of every decision node
+   vector<uint32_t> cmp_index;
+
    DecTree();
    DecTree(const DecTree&);
 
@@ -89,6 +99,7 @@ class DecTree {
    void evaluate(vector<uint64_t> inputs);
    void depthPad();
    void fullTree(uint32_t num_att, uint32_t depth);
+   void compile(bool merge = true);
 
    ~DecTree();
 };
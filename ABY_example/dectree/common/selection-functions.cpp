@@ -22,10 +22,63 @@
 
 #define HE_SCHEME 1 //enum e_HE_crypto_party { e_DGK = 0, e_PAILLIER = 1};
 
+/**
+ * Comparison of every output position of the comparison circuit, where position permutation[i] belongs
+ * to decision node i, see DecTree::compile
+ */
+static vector<uint32_t> cmpPositions(uint64_t numNodes, uint16_t* permutation, vector<uint32_t> &cmpIndex){
+	vector<uint32_t> cmpAt(numNodes);
+	for(uint32_t i = 0; i < numNodes; i++){
+		cmpAt[permutation[i]] = cmpIndex[i];
+	}
+	return cmpAt;
+}
+
+/**
+ * For every output position p of the comparison circuit the first position with the same comparison
+ */
+static vector<uint32_t> firstPositions(uint64_t numNodes, vector<uint32_t> &cmpAt){
+	vector<uint32_t> first(numNodes), firstOfCmp(numNodes, numNodes);
+	for(uint32_t p = 0; p < numNodes; p++){
+		if(firstOfCmp[cmpAt[p]] == numNodes){
+			firstOfCmp[cmpAt[p]] = p;
+		}
+		first[p] = firstOfCmp[cmpAt[p]];
+	}
+	return first;
+}
+
+/**
+ * Dummy attribute and threshold of every comparison, positions with the same comparison get the same
+ * ones, as a real tree would give them
+ */
+static void dummyComparisons(uint64_t numNodes, uint32_t dim, vector<uint32_t> &cmpAttribute, vector<uint64_t> &cmpThreshold){
+	cmpAttribute.resize(numNodes);
+	cmpThreshold.resize(numNodes);
+	for(uint32_t c = 0; c < numNodes; c++){
+		cmpAttribute[c] = rand() % dim;
+		cmpThreshold[c] = rand();
+	}
+}
+
+/**
+ * Repeated comparisons are not built again: their position gets the output share of the first position
+ * with the same comparison, so a repeat costs no gate. The circuit is known to both parties, so the
+ * client learns which positions share a comparison and sees the same output key at all of them. This
+ * is more than HHH leaks, where only the number of distinct comparisons num_cmps is revealed.
+ */
+static void fanOutComparisons(uint64_t numNodes, vector<uint32_t> &first, share** CircOut){
+	for(uint32_t p = 0; p < numNodes; p++) {
+		if(first[p] != p){
+			CircOut[p] = CircOut[first[p]];
+		}
+	}
+}
+
 /**
  * Selection function (homomorphic encryption)
  */
-void selction_HE(e_role role, channel* channel, vector<uint64_t> &featureVec, seclvl seclvl, uint64_t numDecisionNodes, uint16_t* permutation, BooleanCircuit* &Circ, share** &CircOut){
+void selction_HE(e_role role, channel* channel, vector<uint64_t> &featureVec, seclvl seclvl, uint64_t numDecisionNodes, uint16_t* permutation, vector<uint32_t> &cmpIndex, BooleanCircuit* &Circ, share** &CircOut){
 
 	struct timespec start, end, clientOnline;
 	uint32_t dimension = featureVec.size();
@@ -56,7 +109,12 @@ void selction_HE(e_role role, channel* channel, vector<uint64_t> &featureVec, se
 
 	mpz_t *m_pRandomdMasks = (mpz_t*) calloc(numDecisionNodes, sizeof(mpz_t)); // random masks vector 
 	vector<uint64_t> m_nRandomMasksVec;
-	vector<uint64_t> m_vSelection; // feature selection function (mapping)
+	vector<uint64_t> m_vSelection(numDecisionNodes); // feature selection function (mapping)
+	vector<uint32_t> cmpAt = cmpPositions(numDecisionNodes, permutation, cmpIndex);
+	vector<uint32_t> first = firstPositions(numDecisionNodes, cmpAt);
+	vector<uint32_t> cmpAttribute;
+	vector<uint64_t> cmpThreshold;
+	dummyComparisons(numDecisionNodes, dimension, cmpAttribute, cmpThreshold);
 
 	uint64_t lo, hi;
 	mpz_t tmp;
@@ -65,7 +123,7 @@ void selction_HE(e_role role, channel* channel, vector<uint64_t> &featureVec, se
 	for(int i=0; i < numDecisionNodes; i++){
 		mpz_init(m_pRandomdMasks[i]);
 		mpz_urandomb (m_pRandomdMasks[i], m_randstate, MaskBitLen); // MaskBitLen 104
-		m_vSelection.push_back(rand() % dimension); // dummy selection function 
+		m_vSelection[i] = cmpAttribute[cmpAt[i]]; // dummy selection function 
 
 		//truncating random masks to sizeof uint64_t
 		mpz_mod_2exp( tmp, m_pRandomdMasks[i], 64 );   /* tmp = (lower 64 bits of m_pRandomdMasks[i]) */
@@ -108,34 +166,44 @@ void selction_HE(e_role role, channel* channel, vector<uint64_t> &featureVec, se
 	share **tresholdShr, **featureVecShr, **rndMasksVecShr;
 
 	//----------------Settign server input ----------------
+	//only the first position of every comparison has inputs, the others are fanned out
 	tresholdShr = (share**) malloc(sizeof(share*) * numDecisionNodes);
 	for(int i = 0; i < numDecisionNodes; i++) {
-		tresholdVec.push_back(rand());
-		tresholdShr[permutation[i]] = Circ->PutSIMDINGate(1, tresholdVec[i], maxbitlen, SERVER);
+		tresholdVec.push_back(cmpThreshold[cmpAt[i]]);
+		if(first[i] == i){
+			tresholdShr[i] = Circ->PutSIMDINGate(1, tresholdVec[i], maxbitlen, SERVER);
+		}
 	}
 	rndMasksVecShr = (share**) malloc(sizeof(share*) * numDecisionNodes);
 	for(int i = 0; i < numDecisionNodes; i++) {
-		rndMasksVecShr[i] = Circ->PutSIMDINGate(1, m_nRandomMasksVec[i], maxbitlen, SERVER);
+		if(first[i] == i){
+			rndMasksVecShr[i] = Circ->PutSIMDINGate(1, m_nRandomMasksVec[i], maxbitlen, SERVER);
+		}
 	}
 	//----------------Setting client input-------------
 	featureVecShr = (share**) malloc(sizeof(share*) * numDecisionNodes);
 	for(int i = 0; i < numDecisionNodes; i++) {
-		featureVecShr[i] = Circ->PutSIMDINGate(1, m_vTruncBlindedFeatureVec[i], maxbitlen, CLIENT);
+		if(first[i] == i){
+			featureVecShr[i] = Circ->PutSIMDINGate(1, m_vTruncBlindedFeatureVec[i], maxbitlen, CLIENT);
+		}
 	}
 	//----------------Subtraction & comparison ciruit--------------
 	CircOut = (share**) malloc(sizeof(share*) * numDecisionNodes);
 	assert(Circ->GetCircuitType() == C_BOOLEAN);
 
 	for(int i = 0; i < numDecisionNodes; i++) {
-		CircOut[i] = Circ->PutSUBGate(featureVecShr[i], rndMasksVecShr[i]);
-		CircOut[i] = Circ->PutGTGate(CircOut[i], tresholdShr[i]);
+		if(first[i] == i){
+			CircOut[i] = Circ->PutSUBGate(featureVecShr[i], rndMasksVecShr[i]);
+			CircOut[i] = Circ->PutGTGate(CircOut[i], tresholdShr[i]);
+		}
 	}
+	fanOutComparisons(numDecisionNodes, first, CircOut);
 }
 
 /**
  * Selection function (garbled circuit)
  */
-void selction_GC(vector<uint64_t> &featureVec, uint64_t numDecisionNodes, uint16_t* permutation, BooleanCircuit* &Circ, share** &CircOut) {
+void selction_GC(vector<uint64_t> &featureVec, uint64_t numDecisionNodes, uint16_t* permutation, vector<uint32_t> &cmpIndex, BooleanCircuit* &Circ, share** &CircOut) {
 
 	uint16_t dim = featureVec.size();
 	uint16_t m_numNodes = numDecisionNodes;
@@ -150,9 +218,14 @@ void selction_GC(vector<uint64_t> &featureVec, uint64_t numDecisionNodes, uint16
 	}
 
 	//-----------Output Program (Mapping) of Selection Block --------------
+	vector<uint32_t> cmpAt = cmpPositions(m_numNodes, permutation, cmpIndex);
+	vector<uint32_t> first = firstPositions(m_numNodes, cmpAt);
+	vector<uint32_t> cmpAttribute;
+	vector<uint64_t> cmpThreshold;
+	dummyComparisons(m_numNodes, dim, cmpAttribute, cmpThreshold);
 	uint32_t *m_nMapping = (uint32_t*) malloc(sizeof(uint32_t) * m_numNodes);
 	for(int i = 0; i < m_numNodes; i++){
-		m_nMapping[permutation[i]] = rand() % dim;
+		m_nMapping[i] = cmpAttribute[cmpAt[i]];
 	}
 	selBlock->SelectionBlockProgram(m_nMapping);
 	selBlock->SetControlBits();
@@ -163,8 +236,10 @@ void selction_GC(vector<uint64_t> &featureVec, uint64_t numDecisionNodes, uint16
 	//----------------Settign server input ----------------
 	tresholdShr = (share**) malloc(sizeof(share*) * m_numNodes);
 	for(int i = 0; i < m_numNodes; i++) {
-		tresholdVec.push_back(rand());
-		tresholdShr[permutation[i]] = Circ->PutSIMDINGate(1, tresholdVec[i], maxbitlen, SERVER);
+		tresholdVec.push_back(cmpThreshold[cmpAt[i]]);
+		if(first[i] == i){
+			tresholdShr[i] = Circ->PutSIMDINGate(1, tresholdVec[i], maxbitlen, SERVER);
+		}
 	}
 
 	//----------------Setting client input-------------
@@ -194,6 +269,9 @@ void selction_GC(vector<uint64_t> &featureVec, uint64_t numDecisionNodes, uint16
 	}
 	
 	for (int i=0; i < m_numNodes; i++) {
-		CircOut[i] = Circ->PutGTGate(SelectionBlockOutput[i], tresholdShr[i]);
+		if(first[i] == i){
+			CircOut[i] = Circ->PutGTGate(SelectionBlockOutput[i], tresholdShr[i]);
+		}
 	}
+	fanOutComparisons(m_numNodes, first, CircOut);
 }
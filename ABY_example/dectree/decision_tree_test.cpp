@@ -85,6 +85,7 @@ int main(int argc, char** argv) {
 	DecTree tree;
 	tree.read_from_file(dectree_rootdir + dectree_filename);
 	tree.depthPad();
+	tree.compile();
 	//tree.fullTree(featureVecDimension, depth);
 	featureVecDimension = tree.num_attributes; numNodes = tree.num_dec_nodes; //Setting new values if reading from file
 
@@ -0,0 +1,210 @@
+/**
+ \file 		bit_pool.hpp
+ \author 	kiss@encrypto.cs.tu-darmstadt.de
+ \copyright	Bit ciphertext pool
+			Copyright (C) 2019 Cryptography and Privacy Engineering Group, TU Darmstadt
+			This program is free software: you can redistribute it and/or modify
+			it under the terms of the GNU Affero General Public License as published
+			by the Free Software Foundation, either version 3 of the License, or
+			(at your option) any later version.
+			This program is distributed in the hope that it will be useful,
+			but WITHOUT ANY WARRANTY; without even the implied warranty of
+			MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+			GNU Affero General Public License for more details.
+			You should have received a copy of the GNU Affero General Public License
+			along with this program. If not, see <http://www.gnu.org/licenses/>.
+ \brief		Pool of precomputed encryptions of 0 and of 1. The client takes its bit
+			encryptions from here during the online phase, while a background thread
+			refills the pool from enc_off precomputations.
+ */
+
+#ifndef BIT_POOL_H_INCLUDED
+#define BIT_POOL_H_INCLUDED
+
+#include <stdint.h>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "drbg.hpp"
+
+template<class Elgamal>
+class BitCipherPool {
+  public:
+	typedef typename Elgamal::CipherText CipherText;
+	typedef typename Elgamal::PublicKey PublicKey;
+
+	/**
+	 * @param low refill starts when fewer than low ciphertexts of a bit value are left
+	 * @param high refill stops when high ciphertexts of each bit value are available
+	 */
+	BitCipherPool(const PublicKey& pub, size_t low, size_t high);
+	~BitCipherPool();
+
+	//fills both pools up to the high watermark in the calling thread, call before start()
+	//precomputed encryptions of 0 (e.g. from an OfflineStore) are used before encrypting anew
+	void fill(const std::vector<CipherText>& zeros = std::vector<CipherText>());
+	//starts the background refill thread
+	void start();
+	//c = Enc(bit) from the pool, encrypted on the spot if the pool ran dry
+	void take(CipherText& c, int bit);
+
+	size_t available(int bit);
+	//number of takes served from the pool
+	uint64_t hits() const { return num_hits; }
+	//number of takes that found the pool empty and had to encrypt online
+	uint64_t misses() const { return num_misses; }
+
+  private:
+	void encrypt(CipherText& c, int bit, AesCtrDrbg& rng) const;
+	void encrypt(CipherText* c, size_t n, int bit, AesCtrDrbg& rng) const;
+	bool needs_refill() const;
+	void refill();
+
+	//ciphertexts the refill thread encrypts at once, see PublicKey::encOffBatch
+	static const size_t refill_batch = 32;
+
+	const PublicKey& pub;
+	const size_t low_watermark;
+	const size_t high_watermark;
+	std::deque<CipherText> pool[2];
+	uint64_t num_hits;
+	uint64_t num_misses;
+	AesCtrDrbg refill_rng;
+	AesCtrDrbg online_rng;
+	std::thread refiller;
+	std::mutex mtx;
+	std::condition_variable cv;
+	bool stopping;
+};
+
+template<class Elgamal>
+BitCipherPool<Elgamal>::BitCipherPool(const PublicKey& pub, size_t low, size_t high)
+  : pub(pub)
+  , low_watermark(low)
+  , high_watermark(high)
+  , num_hits(0)
+  , num_misses(0)
+  , stopping(false)
+  {}
+
+template<class Elgamal>
+BitCipherPool<Elgamal>::~BitCipherPool(){
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		stopping = true;
+	}
+	cv.notify_all();
+	if(refiller.joinable()){
+		refiller.join();
+	}
+}
+
+/**
+ * Enc(bit) = enc_off, plus f for bit 1
+ */
+template<class Elgamal>
+void BitCipherPool<Elgamal>::encrypt(CipherText& c, int bit, AesCtrDrbg& rng) const{
+	pub.enc_off(c, rng);
+	if(bit){
+		pub.enc_on(c, 1);
+	}
+}
+
+//Enc(bit) of c[0], ..., c[n - 1] in one batch
+template<class Elgamal>
+void BitCipherPool<Elgamal>::encrypt(CipherText* c, size_t n, int bit, AesCtrDrbg& rng) const{
+	pub.encOffBatch(c, n, rng);
+	if(bit){
+		for(size_t i = 0; i < n; i++){
+			pub.enc_on(c[i], 1);
+		}
+	}
+}
+
+template<class Elgamal>
+void BitCipherPool<Elgamal>::fill(const std::vector<CipherText>& zeros){
+	std::vector<CipherText> c;
+	size_t used = 0;
+	for(int bit = 0; bit < 2; ++bit){
+		const size_t have = available(bit);
+		const size_t need = have < high_watermark ? high_watermark - have : 0;
+		const size_t stored = std::min(need, zeros.size() - used);
+		c.assign(zeros.begin() + used, zeros.begin() + used + stored);
+		used += stored;
+		if(bit){
+			for(size_t i = 0; i < c.size(); i++){
+				pub.enc_on(c[i], 1);
+			}
+		}
+		c.resize(need);
+		if(need > stored){
+			encrypt(&c[stored], need - stored, bit, refill_rng);
+		}
+		std::lock_guard<std::mutex> lock(mtx);
+		pool[bit].insert(pool[bit].end(), c.begin(), c.end());
+	}
+}
+
+template<class Elgamal>
+void BitCipherPool<Elgamal>::start(){
+	refiller = std::thread(&BitCipherPool<Elgamal>::refill, this);
+}
+
+template<class Elgamal>
+void BitCipherPool<Elgamal>::take(CipherText& c, int bit){
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		if(!pool[bit].empty()){
+			c = pool[bit].front();
+			pool[bit].pop_front();
+			num_hits++;
+			if(pool[bit].size() < low_watermark){
+				cv.notify_one();
+			}
+			return;
+		}
+		num_misses++;
+		cv.notify_one();
+	}
+	encrypt(c, bit, online_rng);
+}
+
+template<class Elgamal>
+size_t BitCipherPool<Elgamal>::available(int bit){
+	std::lock_guard<std::mutex> lock(mtx);
+	return pool[bit].size();
+}
+
+template<class Elgamal>
+bool BitCipherPool<Elgamal>::needs_refill() const{
+	return pool[0].size() < low_watermark || pool[1].size() < low_watermark;
+}
+
+/**
+ * Background thread: sleeps until a pool drops below the low watermark and then
+ * tops up both pools to the high watermark, in batches of at most refill_batch ciphertexts
+ * that are encrypted without the lock, so that concurrent takes are never blocked by an encryption.
+ */
+template<class Elgamal>
+void BitCipherPool<Elgamal>::refill(){
+	std::vector<CipherText> c;
+	std::unique_lock<std::mutex> lock(mtx);
+	for(;;){
+		cv.wait(lock, [this]{ return stopping || needs_refill(); });
+		if(stopping){
+			return;
+		}
+		while(!stopping && (pool[0].size() < high_watermark || pool[1].size() < high_watermark)){
+			const int bit = pool[0].size() <= pool[1].size() ? 0 : 1;
+			c.resize(std::min(refill_batch, high_watermark - pool[bit].size()));
+			lock.unlock();
+			encrypt(c.data(), c.size(), bit, refill_rng);
+			lock.lock();
+			pool[bit].insert(pool[bit].end(), c.begin(), c.end());
+		}
+	}
+}
+
+#endif // BIT_POOL_H_INCLUDED
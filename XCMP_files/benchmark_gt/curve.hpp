@@ -0,0 +1,119 @@
+/**
+ \file 		curve.hpp
+ \author 	kiss@encrypto.cs.tu-darmstadt.de
+ \copyright	Curve policies
+			Copyright (C) 2019 Cryptography and Privacy Engineering Group, TU Darmstadt
+			This program is free software: you can redistribute it and/or modify
+			it under the terms of the GNU Affero General Public License as published
+			by the Free Software Foundation, either version 3 of the License, or
+			(at your option) any later version.
+			This program is distributed in the hope that it will be useful,
+			but WITHOUT ANY WARRANTY; without even the implied warranty of
+			MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+			GNU Affero General Public License for more details.
+			You should have received a copy of the GNU Affero General Public License
+			along with this program. If not, see <http://www.gnu.org/licenses/>.
+ \brief		Prime-order groups the HHH protocol can be instantiated over. The group of a build is
+			selected at compile time by HHH_CURVE, e.g. -DHHH_CURVE=1 for NIST P-256.
+ */
+
+#ifndef CURVE_H_INCLUDED
+#define CURVE_H_INCLUDED
+
+#include <mcl/fp.hpp>
+#include <mcl/ec.hpp>
+#include <mcl/elgamal.hpp>
+#include <mcl/ecparam.hpp>
+
+#ifndef HHH_CURVE
+#define HHH_CURVE 0 //0 for secp256k1, 1 for NIST P-256, 2 for the G1 group of BN254
+#endif
+
+/*
+	a curve policy provides the parameters of a prime-order group and the tags of its fields, the tags
+	must differ between policies used in the same program since mcl keeps the field parameters per tag
+*/
+struct Secp256k1Curve {
+	typedef mcl::FpTag FpTag;
+	typedef mcl::ZnTag ZnTag;
+	static const mcl::EcParam& param(){
+		return mcl::ecparam::secp256k1;
+	}
+};
+
+struct NistP256Curve {
+	struct FpTag;
+	struct ZnTag;
+	static const mcl::EcParam& param(){
+		return mcl::ecparam::NIST_P256;
+	}
+};
+
+//y^2 = x^3 + 2 over the 254-bit prime of the BN curve of mcl (z = -(2^62 + 2^55 + 1)), generator (-1, 1)
+struct Bn254G1Curve {
+	struct FpTag;
+	struct ZnTag;
+	static const mcl::EcParam& param(){
+		static const mcl::EcParam para = {
+			"bn254_g1",
+			"0x2523648240000001ba344d80000000086121000000000013a700000000000013",
+			"0",
+			"2",
+			"-1",
+			"1",
+			"0x2523648240000001ba344d8000000007ff9f800000000010a10000000000000d",
+			254
+		};
+		return para;
+	}
+};
+
+/**
+ * Lifted ElGamal over the group of the policy Curve
+ */
+template<class Curve>
+struct CurveGroup {
+	typedef mcl::FpT<typename Curve::FpTag> Fp;
+	typedef mcl::FpT<typename Curve::ZnTag> Zn;
+	typedef mcl::EcT<Fp> Ec;
+	typedef mcl::ElgamalT<Ec, Zn> Elgamal;
+
+	static const char* name(){
+		return Curve::param().name;
+	}
+
+	static size_t bitSize(){
+		return Curve::param().bitSize;
+	}
+
+	static Ec generator(){
+		const mcl::EcParam& para = Curve::param();
+		return Ec(Fp(para.gx), Fp(para.gy));
+	}
+
+	//sets up the fields and the curve
+	static void init(){
+		const mcl::EcParam& para = Curve::param();
+		Zn::init(para.n);
+		Fp::init(para.p);
+		Ec::init(para.a, para.b);
+	}
+};
+
+#if HHH_CURVE == 0
+typedef Secp256k1Curve HHHCurve;
+#elif HHH_CURVE == 1
+typedef NistP256Curve HHHCurve;
+#elif HHH_CURVE == 2
+typedef Bn254G1Curve HHHCurve;
+#else
+#error "unknown HHH_CURVE"
+#endif
+
+typedef CurveGroup<HHHCurve> HHHGroup;
+typedef HHHGroup::Fp Fp;
+typedef HHHGroup::Zn Zn; // Zn has its own tag because it is a different class than Fp
+typedef HHHGroup::Ec Ec;
+typedef HHHGroup::Elgamal Elgamal;
+
+#endif // CURVE_H_INCLUDED
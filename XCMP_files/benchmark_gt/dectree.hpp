@@ -30,23 +30,17 @@
 #include <vector>
 #include <algorithm>
 #include <stdint.h>
+#include <errno.h>
 #include <math.h>       /* pow */
+#include <map>
 
 #include <cybozu/random_generator.hpp>
+#include <cybozu/exception.hpp>
 #include <cybozu/option.hpp>
 #include <cybozu/crypto.hpp>
 #include <cybozu/itoa.hpp>
-#include <mcl/fp.hpp>
-#include <mcl/ec.hpp>
-#include <mcl/elgamal.hpp>
-#include <mcl/ecparam.hpp>
 #include <mcl/bn256.hpp>
 
-typedef mcl::FpT<> Fp;
-typedef mcl::FpT<mcl::ZnTag> Zn; // use ZnTag because Zn is different class with Fp
-typedef mcl::EcT<Fp> Ec;
-typedef mcl::ElgamalT<Ec, Zn> Elgamal;
-
 using namespace std;
 
 class DecTree {
@@ -68,8 +62,8 @@ class DecTree {
         uint64_t classification;
         // Attribute index to compare with, -1 if undefined
         uint32_t attribute_index;
-        //pathcost until this node
-        Elgamal::CipherText path_cost;
+        // Position in node_vec, indexes per-evaluation state such as the path costs of a session
+        uint32_t id;
 
         Node();
         Node(const Node&);
@@ -85,7 +79,7 @@ class DecTree {
    vector<uint64_t> thresholds;
 
    //STATISTICS FOR DECISION TREES
-   //number of attributes
+   //number of attributes, i.e. the largest attribute index plus 1
    uint32_t num_attributes;
    //number of decision nodes
    uint32_t num_dec_nodes;
@@ -96,6 +90,19 @@ class DecTree {
    //dummy in our case
    uint32_t dummy_non_full;
 
+   //COMPILED COMPARISONS, filled by compile()
+   //number of distinct comparisons
+   uint32_t num_cmps;
+   //attribute index and threshold of every distinct comparison
+   vector<uint32_t> cmp_attributes;
+   vector<uint64_t> cmp_thresholds;
+   //index of the comparison of every decision node
+   vector<uint32_t> cmp_index;
+   //bits every attribute is compared on (8, 16, 32 or 64), see compile()
+   vector<uint32_t> attribute_bits;
+   //added to the scaled thresholds and inputs of every attribute so that they are not negative, see read_from_file()
+   vector<uint64_t> attribute_offsets;
+
    DecTree();
    DecTree(const DecTree&);
 
@@ -106,12 +113,17 @@ class DecTree {
    void evaluate(vector<uint64_t> inputs);
    void depthPad();
    void fullTree(uint32_t num_att, uint32_t depth);
+   void compile(bool merge = true);
 
    ~DecTree();
+
+  private:
+   DecTree& operator=(const DecTree&);
 };
 
 void tokenize(const std::string&, std::vector<string>&);
 void eraseSubStr(std::string &, const std::string &);
+uint32_t parse_index(const std::string&, uint32_t);
 
 /**
  * Node constructor that takes its number num, by default it has no children
@@ -127,17 +139,23 @@ DecTree::Node::Node()
   , threshold(0)
   , attribute_index(0)
   , classification(0)
+  , id(0)
   {}
 
+/**
+ * Copies the fields of a node but not its links, which point into the tree that owns other,
+ * see the copy constructor of DecTree
+ */
 DecTree::Node::Node(const Node& other){
-    left = new Node(*(other.left));
-    right = new Node(*(other.right));
-    parent = new Node(*(other.parent));
+    left = 0;
+    right = 0;
+    parent = 0;
     level = other.level;
     leaf = other.leaf;
     threshold = other.threshold;
     attribute_index = other.attribute_index;
     classification = other.classification;
+    id = other.id;
 }
 
 /**
@@ -151,11 +169,27 @@ DecTree::DecTree()
     depth = 0;
     num_of_leaves = 0;
     dummy_non_full = 0;
+    num_cmps = 0;
 }
 
+/**
+ * Deep copy, the copied nodes are linked as those of other
+ */
 DecTree::DecTree(const DecTree& other){
-    node_vec = other.node_vec;
-    decnode_vec = other.decnode_vec;
+    map<const Node*, Node*> copy_of;
+    copy_of[0] = 0;
+    for(uint32_t i = 0; i < other.node_vec.size(); ++i){
+        node_vec.push_back(new Node(*(other.node_vec[i])));
+        copy_of[other.node_vec[i]] = node_vec[i];
+    }
+    for(uint32_t i = 0; i < other.node_vec.size(); ++i){
+        node_vec[i]->left = copy_of[other.node_vec[i]->left];
+        node_vec[i]->right = copy_of[other.node_vec[i]->right];
+        node_vec[i]->parent = copy_of[other.node_vec[i]->parent];
+    }
+    for(uint32_t i = 0; i < other.decnode_vec.size(); ++i){
+        decnode_vec.push_back(copy_of[other.decnode_vec[i]]);
+    }
     attributes = other.attributes;
     thresholds = other.thresholds;
     num_attributes = other.num_attributes;
@@ -163,6 +197,12 @@ DecTree::DecTree(const DecTree& other){
     depth = other.depth;
     num_of_leaves = other.num_of_leaves;
     dummy_non_full = other.dummy_non_full;
+    num_cmps = other.num_cmps;
+    cmp_attributes = other.cmp_attributes;
+    cmp_thresholds = other.cmp_thresholds;
+    cmp_index = other.cmp_index;
+    attribute_bits = other.attribute_bits;
+    attribute_offsets = other.attribute_offsets;
 }
 
 /**
@@ -170,6 +210,7 @@ DecTree::DecTree(const DecTree& other){
  * @param node the Node to be added to the tree
  */
 void DecTree::add_node(DecTree::Node* node){
+    node->id = node_vec.size();
     node_vec.push_back(node);
 }
 
@@ -230,6 +271,22 @@ void eraseSubStr(std::string & mainStr, const std::string & toErase)
 	}
 }
 
+/**
+ * Parses a node id or an attribute index of a tree file
+ * @param token the decimal number
+ * @param end the number must be below end
+ * @throws cybozu::Exception if token is not a decimal number below end
+ */
+uint32_t parse_index(const std::string& token, uint32_t end){
+	char* stop;
+	errno = 0;
+	const unsigned long long value = strtoull(token.c_str(), &stop, 10);
+	if(token.empty() || token[0] == '-' || *stop != '\0' || errno != 0 || value >= end){
+		throw cybozu::Exception("dectree:parse_index:bad number") << token << end;
+	}
+	return (uint32_t)value;
+}
+
 class SearchFunction {
     public:
         SearchFunction(uint32_t item): item_(item) {}
@@ -241,11 +298,13 @@ class SearchFunction {
 };
 
 //root node will be in decnode_vec[0] and node_vec[0]
+//throws cybozu::Exception if a line is malformed, the nodes read so far are freed with the tree
+//thresholds t are scaled to floor(1000 t) and offset per attribute by attribute_offsets, which makes
+//the smallest of them 0 if it is negative (e.g. centred features), inputs must be scaled and offset alike
 void DecTree::read_from_file(string string_file){
     const char* filename = string_file.c_str();
     ifstream file;
     file.open(filename);
-    cout << filename << endl;
 
     //ofstream file2;
     //file2.open("dectree.txt", std::ios_base::app);
@@ -257,44 +316,84 @@ void DecTree::read_from_file(string string_file){
     uint32_t index;
     string line;
     vector<string> tokens;
-    vector<uint64_t>::iterator it;
     float thres;
+    vector<int64_t> scaled; //scaled threshold of every decision node, before the offset
     while (getline(file, line)){
         tokenize(line, tokens);
+        if(tokens.size() < 3){ //e.g. the closing brace
+            continue;
+        }
         if(tokens[1] == "label=\"gini"){
-            node1 = atoi(tokens[0].c_str());
+            if(tokens.size() < 7){
+                throw cybozu::Exception("dectree:read_from_file:bad leaf") << filename << line;
+            }
+            node1 = parse_index(tokens[0], this->node_vec.size() + 1);
+            if(node1 != this->node_vec.size()){ //nodes are numbered in the order they appear
+                throw cybozu::Exception("dectree:read_from_file:bad node id") << filename << node1;
+            }
             this->add_node(new DecTree::Node());
             this->node_vec[node1]->leaf = true;
             this->num_of_leaves++;
             this->node_vec[node1]->classification = atoi(tokens[6].c_str());
         }
         else if(tokens[1] == "label=\"X"){
-            node1 = atoi(tokens[0].c_str());
+            if(tokens.size() < 5){
+                throw cybozu::Exception("dectree:read_from_file:bad decision node") << filename << line;
+            }
+            node1 = parse_index(tokens[0], this->node_vec.size() + 1);
+            if(node1 != this->node_vec.size()){
+                throw cybozu::Exception("dectree:read_from_file:bad node id") << filename << node1;
+            }
             //cout << node1 << endl;
+            index = parse_index(tokens[2], UINT32_MAX);
             node = new DecTree::Node();
-            index = atoi(tokens[2].c_str());
             node->attribute_index = index;
             //cout << index << endl;
             thres = atof(tokens[4].c_str());
-            node->threshold = thres*1000;
-            //cout << node->threshold << endl; //Thresholds are converted so that we only compare integers
+            thres = floorf(thres*1000); //Thresholds are converted so that we only compare integers
+            if(!(fabsf(thres) < 4e18f)){ //the offset threshold still fits into 63 bits
+                delete node;
+                throw cybozu::Exception("dectree:read_from_file:bad threshold") << filename << tokens[4];
+            }
+            scaled.push_back((int64_t)thres);
             this->num_dec_nodes++;
             this->add_node(node);
             this->add_decnode(node);
 
-            it = find_if(this->attributes.begin(), this->attributes.end(), SearchFunction(index));
-            if(it == this->attributes.end()){
-                this->num_attributes++;
+            if(index >= this->num_attributes){ //attribute_index indexes the feature vector, which may have features no node tests
+                this->num_attributes = index + 1;
             }
             this->attributes.push_back(index);
-            this->thresholds.push_back(node->threshold);
         }
         else if(tokens[1] == "->"){
-            node1 = atoi(tokens[0].c_str());
-            node2 = atoi(tokens[2].c_str());
+            node1 = parse_index(tokens[0], this->node_vec.size());
+            node2 = parse_index(tokens[2], this->node_vec.size());
+            //children come after their parent, get one parent and are added to decision nodes only
+            if(node2 <= node1 || this->node_vec[node2]->parent != NULL || this->node_vec[node1]->leaf
+                    || this->node_vec[node1]->right != NULL){
+                throw cybozu::Exception("dectree:read_from_file:bad edge") << filename << node1 << node2;
+            }
             this->add_edge(this->node_vec[node1], this->node_vec[node2]);
         }
     }
+    for(uint32_t i = 0; i < this->node_vec.size(); ++i){
+        node = this->node_vec[i];
+        if((i > 0 && node->parent == NULL) || (!node->leaf && node->right == NULL)){
+            throw cybozu::Exception("dectree:read_from_file:incomplete tree") << filename << i;
+        }
+    }
+    this->attribute_offsets.assign(this->num_attributes, 0);
+    for(uint32_t i = 0; i < this->decnode_vec.size(); ++i){
+        uint64_t& offset = this->attribute_offsets[this->decnode_vec[i]->attribute_index];
+        if(scaled[i] < 0 && (uint64_t)-scaled[i] > offset){
+            offset = -scaled[i];
+        }
+    }
+    for(uint32_t i = 0; i < this->decnode_vec.size(); ++i){
+        node = this->decnode_vec[i];
+        node->threshold = (uint64_t)(scaled[i] + (int64_t)this->attribute_offsets[node->attribute_index]);
+        this->thresholds.push_back(node->threshold);
+    }
     for(uint32_t i = 0; i < this->node_vec.size(); ++i){
         node = this->node_vec[i];
         if(node->leaf){ //Right is also 0 in this case
@@ -338,6 +437,7 @@ void DecTree::fullTree(uint32_t num_att, uint32_t tree_depth){
     vector<uint64_t> thres(this->num_dec_nodes, 0);
     this->attributes = attr;
     this->thresholds = thres;
+    this->attribute_offsets.assign(num_att, 0);
 
     for(uint32_t i = 0; i < this->num_dec_nodes + this->num_of_leaves; ++i){
         DecTree::Node* newNode = new DecTree::Node();
@@ -362,7 +462,7 @@ void DecTree::fullTree(uint32_t num_att, uint32_t tree_depth){
         else{
             newNode->leaf = true;
         }
-        this->node_vec.push_back(newNode);
+        this->add_node(newNode);
     }
 }
 
@@ -373,6 +473,7 @@ void DecTree::depthPad(){
             if(this->node_vec[i]->level != this->depth){
                 tmp = this->node_vec[i];
                 this->node_vec[i] = new DecTree::Node();
+                this->node_vec[i]->id = i;
                 this->node_vec[i]->parent = tmp->parent;
                 this->node_vec[i]->level = tmp->level; //leaf is false, threshold is 0, attribute_index is 0
                 this->decnode_vec.push_back(this->node_vec[i]);
@@ -384,13 +485,50 @@ void DecTree::depthPad(){
                 tmp->parent = this->node_vec[i];
                 this->node_vec[i]->left = tmp;
                 this->node_vec[i]->right = tmp;
-                this->node_vec.push_back(tmp);
+                this->add_node(tmp);
             }
         }
     }
     //cout << "Number of decision nodes " << this->num_dec_nodes << endl;
 }
 
+/**
+ * Finds the distinct (attribute, threshold) comparisons of the decision nodes, so that each of them
+ * is evaluated once and its result is used by all decision nodes that test it.
+ * Also sets the bit width of every attribute to the smallest of 8, 16, 32, 64 bits for which all its
+ * thresholds are below 2^width - 1. Inputs saturated to 2^width - 1 then compare with every threshold
+ * as the original inputs do, so the client does not need to declare the domain of its features.
+ * Call after the tree is complete, i.e., after depthPad() or fullTree() if used.
+ * @param merge if false, every decision node gets a comparison of its own
+ */
+void DecTree::compile(bool merge){
+    map<pair<uint32_t, uint64_t>, uint32_t> index_of;
+    this->cmp_attributes.clear();
+    this->cmp_thresholds.clear();
+    this->cmp_index.resize(this->decnode_vec.size());
+    for(uint32_t i = 0; i < this->decnode_vec.size(); ++i){
+        pair<uint32_t, uint64_t> cmp(this->decnode_vec[i]->attribute_index, this->decnode_vec[i]->threshold);
+        map<pair<uint32_t, uint64_t>, uint32_t>::iterator it = index_of.find(cmp);
+        if(merge && it != index_of.end()){
+            this->cmp_index[i] = it->second;
+            continue;
+        }
+        this->cmp_index[i] = this->cmp_attributes.size();
+        index_of[cmp] = this->cmp_index[i];
+        this->cmp_attributes.push_back(cmp.first);
+        this->cmp_thresholds.push_back(cmp.second);
+    }
+    this->num_cmps = this->cmp_attributes.size();
+
+    this->attribute_bits.assign(this->num_attributes, 8);
+    for(uint32_t c = 0; c < this->num_cmps; ++c){
+        uint32_t& bits = this->attribute_bits[this->cmp_attributes[c]];
+        while(bits < 64 && this->cmp_thresholds[c] >= (1ULL << bits) - 1){
+            bits *= 2;
+        }
+    }
+}
+
 void DecTree::evaluate(vector<uint64_t> inputs){
     DecTree::Node* this_node = this->node_vec[0];
     while(!(this_node->leaf)){
@@ -406,10 +544,13 @@ void DecTree::evaluate(vector<uint64_t> inputs){
 }
 
 /**
- * Destructor DecTree
+ * Destructor DecTree, the tree owns all nodes in node_vec (decnode_vec holds a subset of them)
  */
 DecTree::~DecTree(){
-	node_vec.clear();
+    for(uint32_t i = 0; i < node_vec.size(); ++i){
+        delete node_vec[i];
+    }
+    node_vec.clear();
 }
 
 #endif // DECTREE_H_INCLUDED
@@ -0,0 +1,302 @@
+/**
+ \file 		drbg.hpp
+ \author 	kiss@encrypto.cs.tu-darmstadt.de
+ \copyright	AES-CTR random generator
+			Copyright (C) 2019 Cryptography and Privacy Engineering Group, TU Darmstadt
+			This program is free software: you can redistribute it and/or modify
+			it under the terms of the GNU Affero General Public License as published
+			by the Free Software Foundation, either version 3 of the License, or
+			(at your option) any later version.
+			This program is distributed in the hope that it will be useful,
+			but WITHOUT ANY WARRANTY; without even the implied warranty of
+			MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+			GNU Affero General Public License for more details.
+			You should have received a copy of the GNU Affero General Public License
+			along with this program. If not, see <http://www.gnu.org/licenses/>.
+ \brief		Buffered random generator running AES-128 in counter mode, seeded once from the OS. It has the
+			interface of cybozu::RandomGenerator, so it can be passed wherever mcl takes an fp::RandGen, and
+			is a UniformRandomBitGenerator for std::shuffle. An instance must not be shared between threads,
+			every thread uses its own. AES-NI is used if the CPU has it, detected at run time, otherwise a
+			portable AES in constant time, whose S-box is computed on bit slices instead of looked up.
+ */
+
+#ifndef DRBG_H_INCLUDED
+#define DRBG_H_INCLUDED
+
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <cybozu/random_generator.hpp>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define DRBG_AESNI 1
+#include <cpuid.h>
+#include <wmmintrin.h>
+#endif
+
+class AesCtrDrbg {
+  public:
+	typedef uint32_t result_type;
+
+	//seeded from the OS
+	AesCtrDrbg();
+	~AesCtrDrbg();
+
+	void read(bool* pb, void* buf, size_t byteSize);
+	template<class T>
+	void read(T* x, size_t n){
+		bool b;
+		read(&b, x, sizeof(T) * n);
+	}
+	uint32_t get32();
+	uint64_t get64();
+	uint32_t operator()(){
+		return get32();
+	}
+	static constexpr result_type min(){
+		return 0;
+	}
+	static constexpr result_type max(){
+		return UINT32_MAX;
+	}
+
+	//FIPS-197 AES-128 in constant time, used by both code paths
+	static void expandKey(uint8_t rk[176], const uint8_t key[16]);
+	static void encryptBlock(uint8_t out[16], const uint8_t in[16], const uint8_t rk[176]);
+	//n <= 4 blocks at once, they share the S-box evaluations
+	static void encryptBlocks(uint8_t* out, const uint8_t* in, size_t n, const uint8_t rk[176]);
+	//true if refill uses AES-NI
+	static bool hasAesni();
+
+  private:
+	static const size_t buf_blocks = 256;
+
+	AesCtrDrbg(const AesCtrDrbg&);
+	AesCtrDrbg& operator=(const AesCtrDrbg&);
+	/*
+		encrypts the counters 0, ..., buf_blocks - 1 under the current key, the first block becomes the
+		next key and the others the output, so that earlier output cannot be recomputed from the state
+	*/
+	void refill();
+
+	uint8_t key[16];
+	uint8_t buf[buf_blocks * 16];
+	size_t pos;
+};
+
+namespace aes_detail {
+
+inline uint8_t xtime(uint8_t x){
+	return (uint8_t)((x << 1) ^ ((x >> 7) * 0x1b));
+}
+
+//product in GF(2^8) of up to 64 bytes held as bit slices, slice i holds bit i of every byte
+inline void mulSlices(uint64_t out[8], const uint64_t a[8], const uint64_t b[8]){
+	uint64_t p[15] = {0};
+	for(int i = 0; i < 8; i++){
+		for(int j = 0; j < 8; j++){
+			p[i + j] ^= a[i] & b[j];
+		}
+	}
+	for(int k = 14; k >= 8; k--){ //x^8 = x^4 + x^3 + x + 1
+		p[k - 4] ^= p[k];
+		p[k - 5] ^= p[k];
+		p[k - 7] ^= p[k];
+		p[k - 8] ^= p[k];
+	}
+	memcpy(out, p, 8 * sizeof(uint64_t));
+}
+
+//S-box on bit slices: the affine map of x^254, which is the inverse of x and 0 for 0
+inline void sboxSlices(uint64_t x[8]){
+	uint64_t x2[8], x3[8], x12[8], t[8];
+	mulSlices(x2, x, x);
+	mulSlices(x3, x2, x);
+	mulSlices(t, x3, x3); //x^6
+	mulSlices(x12, t, t);
+	mulSlices(t, x12, x3); //x^15
+	for(int i = 0; i < 4; i++){ //x^240
+		mulSlices(t, t, t);
+	}
+	mulSlices(t, t, x12); //x^252
+	mulSlices(t, t, x2);
+	for(int i = 0; i < 8; i++){
+		x[i] = t[i] ^ t[(i + 4) % 8] ^ t[(i + 5) % 8] ^ t[(i + 6) % 8] ^ t[(i + 7) % 8] ^ (0 - (uint64_t)((0x63 >> i) & 1));
+	}
+}
+
+//replaces n <= 64 bytes by their S-box values, without secret dependent branches or memory accesses
+inline void subBytes(uint8_t* bytes, size_t n){
+	uint64_t x[8] = {0};
+	for(size_t j = 0; j < n; j++){
+		for(int i = 0; i < 8; i++){
+			x[i] |= (uint64_t)((bytes[j] >> i) & 1) << j;
+		}
+	}
+	sboxSlices(x);
+	for(size_t j = 0; j < n; j++){
+		uint8_t b = 0;
+		for(int i = 0; i < 8; i++){
+			b |= (uint8_t)(((x[i] >> j) & 1) << i);
+		}
+		bytes[j] = b;
+	}
+}
+
+#ifdef DRBG_AESNI
+//AES-NI, only called if the CPU has it
+__attribute__((target("aes,sse2"))) inline void ctrAesni(uint8_t* out, size_t blocks, const uint8_t rk[176]){
+	__m128i k[11];
+	for(int r = 0; r < 11; r++){
+		k[r] = _mm_loadu_si128((const __m128i*)(rk + 16 * r));
+	}
+	for(size_t i = 0; i < blocks; i += 4){ //four independent blocks keep the AES unit busy
+		__m128i x[4];
+		for(int j = 0; j < 4; j++){
+			x[j] = _mm_xor_si128(_mm_set_epi64x(0, (long long)(i + j)), k[0]);
+		}
+		for(int r = 1; r < 10; r++){
+			for(int j = 0; j < 4; j++){
+				x[j] = _mm_aesenc_si128(x[j], k[r]);
+			}
+		}
+		for(int j = 0; j < 4; j++){
+			_mm_storeu_si128((__m128i*)(out + 16 * (i + j)), _mm_aesenclast_si128(x[j], k[10]));
+		}
+	}
+}
+#endif
+
+} // namespace aes_detail
+
+inline AesCtrDrbg::AesCtrDrbg(){
+	cybozu::RandomGenerator os;
+	const uint64_t seed[2] = {os.get64(), os.get64()};
+	memcpy(key, seed, sizeof(key));
+	refill();
+}
+
+inline AesCtrDrbg::~AesCtrDrbg(){
+	memset(key, 0, sizeof(key));
+	memset(buf, 0, sizeof(buf));
+}
+
+inline void AesCtrDrbg::read(bool* pb, void* out, size_t byteSize){
+	uint8_t* p = (uint8_t*)out;
+	while(byteSize > 0){
+		if(pos == sizeof(buf)){
+			refill();
+		}
+		const size_t n = std::min(byteSize, sizeof(buf) - pos);
+		memcpy(p, buf + pos, n);
+		memset(buf + pos, 0, n); //output is not kept
+		pos += n;
+		p += n;
+		byteSize -= n;
+	}
+	*pb = true;
+}
+
+inline uint32_t AesCtrDrbg::get32(){
+	uint32_t x;
+	read(&x, 1);
+	return x;
+}
+
+inline uint64_t AesCtrDrbg::get64(){
+	uint64_t x;
+	read(&x, 1);
+	return x;
+}
+
+inline bool AesCtrDrbg::hasAesni(){
+#ifdef DRBG_AESNI
+	static const bool has = [](){
+		unsigned int a, b, c, d;
+		return __get_cpuid(1, &a, &b, &c, &d) != 0 && (c & bit_AES) != 0;
+	}();
+	return has;
+#else
+	return false;
+#endif
+}
+
+inline void AesCtrDrbg::refill(){
+	uint8_t rk[176];
+	expandKey(rk, key);
+#ifdef DRBG_AESNI
+	if(hasAesni()){
+		aes_detail::ctrAesni(buf, buf_blocks, rk);
+	}
+	else
+#endif
+	{
+		uint8_t ctr[64] = {0};
+		for(size_t i = 0; i < buf_blocks; i += 4){
+			for(size_t b = 0; b < 4; b++){
+				for(int j = 0; j < 8; j++){
+					ctr[16 * b + j] = (uint8_t)((i + b) >> (8 * j));
+				}
+			}
+			encryptBlocks(buf + 16 * i, ctr, 4, rk);
+		}
+	}
+	memcpy(key, buf, sizeof(key));
+	memset(buf, 0, sizeof(key));
+	memset(rk, 0, sizeof(rk));
+	pos = sizeof(key);
+}
+
+inline void AesCtrDrbg::expandKey(uint8_t rk[176], const uint8_t key[16]){
+	memcpy(rk, key, 16);
+	uint8_t rcon = 1;
+	for(int i = 16; i < 176; i += 4){
+		uint8_t t[4] = {rk[i - 4], rk[i - 3], rk[i - 2], rk[i - 1]};
+		if(i % 16 == 0){
+			aes_detail::subBytes(t, 4);
+			const uint8_t t0 = t[0];
+			t[0] = t[1] ^ rcon;
+			t[1] = t[2];
+			t[2] = t[3];
+			t[3] = t0;
+			rcon = aes_detail::xtime(rcon);
+		}
+		for(int j = 0; j < 4; j++){
+			rk[i + j] = rk[i - 16 + j] ^ t[j];
+		}
+	}
+}
+
+inline void AesCtrDrbg::encryptBlock(uint8_t out[16], const uint8_t in[16], const uint8_t rk[176]){
+	encryptBlocks(out, in, 1, rk);
+}
+
+inline void AesCtrDrbg::encryptBlocks(uint8_t* out, const uint8_t* in, size_t n, const uint8_t rk[176]){
+	uint8_t st[64], t[64];
+	for(size_t i = 0; i < 16 * n; i++){
+		st[i] = in[i] ^ rk[i % 16];
+	}
+	for(int r = 1; r < 11; r++){
+		aes_detail::subBytes(st, 16 * n);
+		for(size_t b = 0; b < 16 * n; b += 16){
+			for(int i = 0; i < 16; i++){ //ShiftRows, byte i is row i % 4 of column i / 4
+				t[b + i] = st[b + (i + 4 * (i % 4)) % 16];
+			}
+		}
+		if(r < 10){ //MixColumns
+			for(size_t c = 0; c < 16 * n; c += 4){
+				const uint8_t a0 = t[c], a1 = t[c + 1], a2 = t[c + 2], a3 = t[c + 3];
+				const uint8_t all = a0 ^ a1 ^ a2 ^ a3;
+				t[c] ^= all ^ aes_detail::xtime(a0 ^ a1);
+				t[c + 1] ^= all ^ aes_detail::xtime(a1 ^ a2);
+				t[c + 2] ^= all ^ aes_detail::xtime(a2 ^ a3);
+				t[c + 3] ^= all ^ aes_detail::xtime(a3 ^ a0);
+			}
+		}
+		for(size_t i = 0; i < 16 * n; i++){
+			st[i] = t[i] ^ rk[16 * r + i % 16];
+		}
+	}
+	memcpy(out, st, 16 * n);
+}
+
+#endif // DRBG_H_INCLUDED
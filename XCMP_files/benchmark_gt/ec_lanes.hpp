@@ -0,0 +1,783 @@
+/**
+ \file 		ec_lanes.hpp
+ \author 	kiss@encrypto.cs.tu-darmstadt.de
+ \copyright	Elliptic curve lanes
+			Copyright (C) 2019 Cryptography and Privacy Engineering Group, TU Darmstadt
+			This program is free software: you can redistribute it and/or modify
+			it under the terms of the GNU Affero General Public License as published
+			by the Free Software Foundation, either version 3 of the License, or
+			(at your option) any later version.
+			This program is distributed in the hope that it will be useful,
+			but WITHOUT ANY WARRANTY; without even the implied warranty of
+			MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+			GNU Affero General Public License for more details.
+			You should have received a copy of the GNU Affero General Public License
+			along with this program. If not, see <http://www.gnu.org/licenses/>.
+ \brief		Point arithmetic on eight points at once, one per 64-bit SIMD lane, plugged into
+			ElgamalT::CipherText::batchAdd and batchMul by EcLanes::init. The field arithmetic uses AVX-512
+			IFMA if the CPU has it (6 limbs of 52 bits, _mm512_madd52lo/hi_epu64), otherwise AVX2 (10 limbs
+			of 29 bits, _mm256_mul_epu32, two registers per limb), picked at run time, without either mcl
+			processes the points one by one. The point formulas are shared by both and call the field
+			functions of the picked instruction set.
+ */
+
+#ifndef EC_LANES_H_INCLUDED
+#define EC_LANES_H_INCLUDED
+
+#include <stdint.h>
+#include <string>
+#include <gmpxx.h>
+#if defined(__GNUC__) && defined(__x86_64__)
+#define EC_LANES_X86 1
+#define EC_LANES_AVX2 __attribute__((target("avx2")))
+#define EC_LANES_IFMA __attribute__((target("avx512f,avx512ifma")))
+#include <immintrin.h>
+#endif
+
+template<class Elgamal>
+class EcLanes {
+  public:
+	typedef typename Elgamal::Ec Ec;
+	typedef typename Ec::Fp Fp;
+	enum Isa { none, avx2, avx512ifma };
+
+	//registers the lanes with batchAdd and batchMul for the best instruction set of the CPU up to max, returns it
+	static Isa init(Isa max = avx512ifma);
+
+  private:
+	static const size_t lanes = 8;
+
+	/*
+		field elements are held in limbs of bits bits in Montgomery representation x R mod p, R = 2^(limbs bits)
+		and above 2^289, values are kept below 2^273, so that a product is below 2^256 + p, see fmul, and
+		reduced by fmul only, sums are not reduced and differences add a multiple of p: fsub(z, x, y, k) adds
+		k1, k2 or k3, the first multiple of p of at least 2^262, 2^267 or 2^272, and y must be below half
+		of it, the bounds are given at the callers
+	*/
+	template<size_t limbs>
+	struct Param {
+		uint64_t p[limbs];
+		alignas(64) uint64_t pv[limbs][lanes]; //p in all lanes
+		uint64_t k1[limbs], k2[limbs], k3[limbs]; //spread, no limb of x + k - y is negative
+		uint64_t in[limbs]; //R^2 / R' mod p for mcl's representation x R' mod p
+		uint64_t a[limbs]; //a R mod p of y^2 = x^3 + a x + b
+		uint64_t one[limbs]; //fmul by one leaves the Montgomery representation
+		uint64_t zero[limbs];
+		uint64_t pinv; //-1 / p mod 2^bits
+		bool a_zero;
+	};
+	static size_t& units(){ //of an Fp
+		static size_t n;
+		return n;
+	}
+
+	template<class U>
+	static mpz_class fromUnits(const U* u, size_t n){
+		mpz_class x;
+		mpz_import(x.get_mpz_t(), n, -1, sizeof(U), 0, 0, u);
+		return x;
+	}
+	static void toLimbs(uint64_t* l, const mpz_class& x, size_t bits, size_t limbs){
+		const mpz_class mask = (mpz_class(1) << bits) - 1;
+		for(size_t j = 0; j < limbs; j++){
+			const mpz_class t = (x >> (bits * j)) & mask;
+			l[j] = t.get_ui();
+		}
+	}
+	//k >= 2^min_bits, spread so that limb j < limbs - 1 of k is at least 2^bits - 1
+	static void toSpread(uint64_t* k, const mpz_class& p, size_t min_bits, size_t bits, size_t limbs){
+		const mpz_class m = ((mpz_class(1) << min_bits) + p - 1) / p;
+		toLimbs(k, m * p, bits, limbs);
+		k[0] += uint64_t(1) << bits;
+		for(size_t j = 1; j < limbs - 1; j++){
+			k[j] += (uint64_t(1) << bits) - 1;
+		}
+		k[limbs - 1] -= 1;
+	}
+	static void unitsToLimbs(uint64_t* l, const uint64_t* u, size_t bits, size_t limbs){
+		const uint64_t mask = (uint64_t(1) << bits) - 1;
+		for(size_t j = 0; j < limbs; j++){
+			const size_t w = bits * j / 64, s = bits * j % 64;
+			uint64_t v = w < units() ? u[w] >> s : 0;
+			if(s + bits > 64 && w + 1 < units()){
+				v |= u[w + 1] << (64 - s);
+			}
+			l[j] = v & mask;
+		}
+	}
+	//l below 2^256
+	static void limbsToUnits(uint64_t* u, const uint64_t* l, size_t bits, size_t limbs){
+		for(size_t w = 0; w < 4; w++){
+			u[w] = 0;
+		}
+		for(size_t j = 0; j < limbs; j++){
+			const size_t w = bits * j / 64, s = bits * j % 64;
+			if(w < 4){
+				u[w] |= l[j] << s;
+			}
+			if(s + bits > 64 && w + 1 < 4){
+				u[w + 1] |= l[j] >> (64 - s);
+			}
+		}
+	}
+	template<class F>
+	static void initParam(){
+		Param<F::limbs>& prm = F::param();
+		std::string modulo;
+		Fp::getModulo(modulo);
+		const mpz_class p(modulo);
+		const mpz_class R = mpz_class(1) << (F::bits * F::limbs);
+		//R' is the representation of one, 1 if mcl does not use Montgomery's
+		const mpz_class r = fromUnits(Fp(1).getUnit(), units());
+		mpz_class r_inv, pinv;
+		mpz_invert(r_inv.get_mpz_t(), r.get_mpz_t(), p.get_mpz_t());
+		const mpz_class b = mpz_class(1) << F::bits;
+		mpz_invert(pinv.get_mpz_t(), p.get_mpz_t(), b.get_mpz_t());
+		prm.pinv = mpz_class(b - pinv).get_ui();
+		toLimbs(prm.p, p, F::bits, F::limbs);
+		for(size_t j = 0; j < F::limbs; j++){
+			for(size_t k = 0; k < lanes; k++){
+				prm.pv[j][k] = prm.p[j];
+			}
+		}
+		toLimbs(prm.in, R * R * r_inv % p, F::bits, F::limbs);
+		toLimbs(prm.one, 1, F::bits, F::limbs);
+		toLimbs(prm.zero, 0, F::bits, F::limbs);
+		const mpz_class a = fromUnits(Ec::a_.getUnit(), units()) * r_inv % p;
+		prm.a_zero = a == 0;
+		toLimbs(prm.a, a * R % p, F::bits, F::limbs);
+		toSpread(prm.k1, p, 262, F::bits, F::limbs);
+		toSpread(prm.k2, p, 267, F::bits, F::limbs);
+		toSpread(prm.k3, p, 272, F::bits, F::limbs);
+	}
+
+#ifdef EC_LANES_X86
+	/*
+		the field functions of an instruction set on all lanes, z may alias the arguments, blend sets z to x
+		in the lanes of mask, set loads lane k from l[k] or all lanes from l[0], get stores lane k to l[k]
+	*/
+	struct Avx2 {
+		static const size_t bits = 29, limbs = 10;
+		static const size_t regs = 2; //registers per limb, so that two Montgomery reductions overlap
+		struct Elem {
+			__m256i v[limbs][regs]; //limb j of lane 4 h + i in v[j][h][i]
+		};
+		struct Mask {
+			__m256i m[regs];
+		};
+		static Param<limbs>& param(){
+			static Param<limbs> prm;
+			return prm;
+		}
+		EC_LANES_AVX2 static void carry(Elem& z){
+			const __m256i m = _mm256_set1_epi64x((1 << bits) - 1);
+			for(size_t j = 0; j < limbs - 1; j++){
+				for(size_t h = 0; h < regs; h++){
+					z.v[j + 1][h] = _mm256_add_epi64(z.v[j + 1][h], _mm256_srli_epi64(z.v[j][h], bits));
+					z.v[j][h] = _mm256_and_si256(z.v[j][h], m);
+				}
+			}
+		}
+		//t[i + j] += q p_j for the q that clears the low bits of t[i], which are carried into t[i + 1]
+		EC_LANES_AVX2 static inline void reduceLimb(__m256i (*t)[regs], size_t i){
+			const Param<limbs>& prm = param();
+			const __m256i m = _mm256_set1_epi64x((1 << bits) - 1), pinv = _mm256_set1_epi64x(prm.pinv);
+			__m256i q[regs];
+#pragma GCC unroll 2
+			for(size_t h = 0; h < regs; h++){
+				q[h] = _mm256_and_si256(_mm256_mul_epu32(t[i][h], pinv), m);
+			}
+#pragma GCC unroll 10
+			for(size_t j = 0; j < limbs; j++){
+				const __m256i pj = _mm256_load_si256((const __m256i*)prm.pv[j]);
+#pragma GCC unroll 2
+				for(size_t h = 0; h < regs; h++){
+					t[i + j][h] = _mm256_add_epi64(t[i + j][h], _mm256_mul_epu32(q[h], pj));
+				}
+			}
+#pragma GCC unroll 2
+			for(size_t h = 0; h < regs; h++){
+				t[i + 1][h] = _mm256_add_epi64(t[i + 1][h], _mm256_srli_epi64(t[i][h], bits));
+			}
+		}
+		//z = t / R after reduceLimb on t[0], ..., t[limbs - 1]
+		EC_LANES_AVX2 static inline void reduceOut(Elem& z, __m256i (*t)[regs]){
+			const __m256i m = _mm256_set1_epi64x((1 << bits) - 1);
+#pragma GCC unroll 10
+			for(size_t j = 0; j < limbs - 1; j++){
+#pragma GCC unroll 2
+				for(size_t h = 0; h < regs; h++){
+					t[limbs + j + 1][h] = _mm256_add_epi64(t[limbs + j + 1][h], _mm256_srli_epi64(t[limbs + j][h], bits));
+					z.v[j][h] = _mm256_and_si256(t[limbs + j][h], m);
+				}
+			}
+#pragma GCC unroll 2
+			for(size_t h = 0; h < regs; h++){
+				z.v[limbs - 1][h] = t[2 * limbs - 1][h];
+			}
+		}
+		/*
+			z = x y / R mod p, below 2^256 + p for x, y below 2^273, every column sums at most 20 products
+			of 58 bits, the rows are unrolled so that the columns stay in registers
+		*/
+		EC_LANES_AVX2 static void fmul(Elem& z, const Elem& x, const Elem& y){
+			__m256i t[2 * limbs][regs];
+#pragma GCC unroll 20
+			for(size_t j = 0; j < 2 * limbs; j++){
+#pragma GCC unroll 2
+				for(size_t h = 0; h < regs; h++){
+					t[j][h] = _mm256_setzero_si256();
+				}
+			}
+#pragma GCC unroll 10
+			for(size_t i = 0; i < limbs; i++){
+#pragma GCC unroll 10
+				for(size_t j = 0; j < limbs; j++){
+#pragma GCC unroll 2
+					for(size_t h = 0; h < regs; h++){
+						t[i + j][h] = _mm256_add_epi64(t[i + j][h], _mm256_mul_epu32(x.v[i][h], y.v[j][h]));
+					}
+				}
+				reduceLimb(t, i);
+			}
+			reduceOut(z, t);
+		}
+		//z = x^2 / R mod p like fmul, with 55 products instead of 100
+		EC_LANES_AVX2 static void fsqr(Elem& z, const Elem& x){
+			__m256i t[2 * limbs][regs], d[limbs][regs];
+#pragma GCC unroll 20
+			for(size_t j = 0; j < 2 * limbs; j++){
+#pragma GCC unroll 2
+				for(size_t h = 0; h < regs; h++){
+					t[j][h] = _mm256_setzero_si256();
+				}
+			}
+#pragma GCC unroll 10
+			for(size_t j = 0; j < limbs; j++){
+#pragma GCC unroll 2
+				for(size_t h = 0; h < regs; h++){
+					d[j][h] = _mm256_add_epi64(x.v[j][h], x.v[j][h]);
+				}
+			}
+#pragma GCC unroll 10
+			for(size_t i = 0; i < limbs; i++){
+#pragma GCC unroll 2
+				for(size_t h = 0; h < regs; h++){
+					t[2 * i][h] = _mm256_add_epi64(t[2 * i][h], _mm256_mul_epu32(x.v[i][h], x.v[i][h]));
+				}
+#pragma GCC unroll 10
+				for(size_t j = i + 1; j < limbs; j++){
+#pragma GCC unroll 2
+					for(size_t h = 0; h < regs; h++){
+						t[i + j][h] = _mm256_add_epi64(t[i + j][h], _mm256_mul_epu32(d[i][h], x.v[j][h]));
+					}
+				}
+			}
+#pragma GCC unroll 10
+			for(size_t i = 0; i < limbs; i++){
+				reduceLimb(t, i);
+			}
+			reduceOut(z, t);
+		}
+		EC_LANES_AVX2 static void fadd(Elem& z, const Elem& x, const Elem& y){
+			for(size_t j = 0; j < limbs; j++){
+				for(size_t h = 0; h < regs; h++){
+					z.v[j][h] = _mm256_add_epi64(x.v[j][h], y.v[j][h]);
+				}
+			}
+			carry(z);
+		}
+		//z = x + k - y, see Param
+		EC_LANES_AVX2 static void fsub(Elem& z, const Elem& x, const Elem& y, const uint64_t* k){
+			for(size_t j = 0; j < limbs; j++){
+				const __m256i kj = _mm256_set1_epi64x(k[j]);
+				for(size_t h = 0; h < regs; h++){
+					z.v[j][h] = _mm256_sub_epi64(_mm256_add_epi64(x.v[j][h], kj), y.v[j][h]);
+				}
+			}
+			carry(z);
+		}
+		EC_LANES_AVX2 static void blend(Elem& z, const Elem& x, const Mask& mask){
+			for(size_t j = 0; j < limbs; j++){
+				for(size_t h = 0; h < regs; h++){
+					z.v[j][h] = _mm256_blendv_epi8(z.v[j][h], x.v[j][h], mask.m[h]);
+				}
+			}
+		}
+		EC_LANES_AVX2 static void setMask(Mask& mask, const bool* lane){
+			for(size_t h = 0; h < regs; h++){
+				mask.m[h] = _mm256_set_epi64x(-(int64_t)lane[4 * h + 3], -(int64_t)lane[4 * h + 2],
+					-(int64_t)lane[4 * h + 1], -(int64_t)lane[4 * h]);
+			}
+		}
+		EC_LANES_AVX2 static void set(Elem& z, const uint64_t (*l)[limbs], bool all = false){
+			for(size_t j = 0; j < limbs; j++){
+				for(size_t h = 0; h < regs; h++){
+					z.v[j][h] = all ? _mm256_set1_epi64x(l[0][j])
+						: _mm256_set_epi64x(l[4 * h + 3][j], l[4 * h + 2][j], l[4 * h + 1][j], l[4 * h][j]);
+				}
+			}
+		}
+		EC_LANES_AVX2 static void get(uint64_t (*l)[limbs], const Elem& z){
+			uint64_t v[4];
+			for(size_t j = 0; j < limbs; j++){
+				for(size_t h = 0; h < regs; h++){
+					_mm256_storeu_si256((__m256i*)v, z.v[j][h]);
+					for(size_t i = 0; i < 4; i++){
+						l[4 * h + i][j] = v[i];
+					}
+				}
+			}
+		}
+	};
+
+	struct Ifma {
+		static const size_t bits = 52, limbs = 6;
+		struct Elem {
+			__m512i v[limbs];
+		};
+		struct Mask {
+			__mmask8 m;
+		};
+		static Param<limbs>& param(){
+			static Param<limbs> prm;
+			return prm;
+		}
+		EC_LANES_IFMA static void carry(Elem& z){
+			const __m512i m = _mm512_set1_epi64((uint64_t(1) << bits) - 1);
+			for(size_t j = 0; j < limbs - 1; j++){
+				z.v[j + 1] = _mm512_add_epi64(z.v[j + 1], _mm512_srli_epi64(z.v[j], bits));
+				z.v[j] = _mm512_and_si512(z.v[j], m);
+			}
+		}
+		//t[i + j] += q p_j for the q that clears the low bits of t[i], which are carried into t[i + 1]
+		EC_LANES_IFMA static inline void reduceLimb(__m512i* t, size_t i){
+			const Param<limbs>& prm = param();
+			const __m512i q = _mm512_madd52lo_epu64(_mm512_setzero_si512(), t[i], _mm512_set1_epi64(prm.pinv));
+#pragma GCC unroll 6
+			for(size_t j = 0; j < limbs; j++){
+				const __m512i pj = _mm512_load_si512(prm.pv[j]);
+				t[i + j] = _mm512_madd52lo_epu64(t[i + j], q, pj);
+				t[i + j + 1] = _mm512_madd52hi_epu64(t[i + j + 1], q, pj);
+			}
+			t[i + 1] = _mm512_add_epi64(t[i + 1], _mm512_srli_epi64(t[i], bits));
+		}
+		//z = t / R after reduceLimb on t[0], ..., t[limbs - 1]
+		EC_LANES_IFMA static inline void reduceOut(Elem& z, __m512i* t){
+			const __m512i m = _mm512_set1_epi64((uint64_t(1) << bits) - 1);
+#pragma GCC unroll 6
+			for(size_t j = 0; j < limbs - 1; j++){
+				t[limbs + j + 1] = _mm512_add_epi64(t[limbs + j + 1], _mm512_srli_epi64(t[limbs + j], bits));
+				z.v[j] = _mm512_and_si512(t[limbs + j], m);
+			}
+			z.v[limbs - 1] = t[2 * limbs - 1];
+		}
+		/*
+			z = x y / R mod p, below 2^256 + p for x, y below 2^273, every column sums at most 24 halves
+			of products of 52 bits
+		*/
+		EC_LANES_IFMA static void fmul(Elem& z, const Elem& x, const Elem& y){
+			__m512i t[2 * limbs];
+#pragma GCC unroll 12
+			for(size_t j = 0; j < 2 * limbs; j++){
+				t[j] = _mm512_setzero_si512();
+			}
+#pragma GCC unroll 6
+			for(size_t i = 0; i < limbs; i++){
+#pragma GCC unroll 6
+				for(size_t j = 0; j < limbs; j++){
+					t[i + j] = _mm512_madd52lo_epu64(t[i + j], x.v[i], y.v[j]);
+					t[i + j + 1] = _mm512_madd52hi_epu64(t[i + j + 1], x.v[i], y.v[j]);
+				}
+				reduceLimb(t, i);
+			}
+			reduceOut(z, t);
+		}
+		//z = x^2 / R mod p like fmul, the products of two limbs are summed once and doubled, since IFMA takes 52 bits
+		EC_LANES_IFMA static void fsqr(Elem& z, const Elem& x){
+			__m512i t[2 * limbs];
+#pragma GCC unroll 12
+			for(size_t j = 0; j < 2 * limbs; j++){
+				t[j] = _mm512_setzero_si512();
+			}
+#pragma GCC unroll 6
+			for(size_t i = 0; i < limbs; i++){
+#pragma GCC unroll 6
+				for(size_t j = i + 1; j < limbs; j++){
+					t[i + j] = _mm512_madd52lo_epu64(t[i + j], x.v[i], x.v[j]);
+					t[i + j + 1] = _mm512_madd52hi_epu64(t[i + j + 1], x.v[i], x.v[j]);
+				}
+			}
+#pragma GCC unroll 12
+			for(size_t j = 0; j < 2 * limbs; j++){
+				t[j] = _mm512_add_epi64(t[j], t[j]);
+			}
+#pragma GCC unroll 6
+			for(size_t i = 0; i < limbs; i++){
+				t[2 * i] = _mm512_madd52lo_epu64(t[2 * i], x.v[i], x.v[i]);
+				t[2 * i + 1] = _mm512_madd52hi_epu64(t[2 * i + 1], x.v[i], x.v[i]);
+			}
+#pragma GCC unroll 6
+			for(size_t i = 0; i < limbs; i++){
+				reduceLimb(t, i);
+			}
+			reduceOut(z, t);
+		}
+		EC_LANES_IFMA static void fadd(Elem& z, const Elem& x, const Elem& y){
+			for(size_t j = 0; j < limbs; j++){
+				z.v[j] = _mm512_add_epi64(x.v[j], y.v[j]);
+			}
+			carry(z);
+		}
+		//z = x + k - y, see Param
+		EC_LANES_IFMA static void fsub(Elem& z, const Elem& x, const Elem& y, const uint64_t* k){
+			for(size_t j = 0; j < limbs; j++){
+				z.v[j] = _mm512_sub_epi64(_mm512_add_epi64(x.v[j], _mm512_set1_epi64(k[j])), y.v[j]);
+			}
+			carry(z);
+		}
+		EC_LANES_IFMA static void blend(Elem& z, const Elem& x, const Mask& mask){
+			for(size_t j = 0; j < limbs; j++){
+				z.v[j] = _mm512_mask_blend_epi64(mask.m, z.v[j], x.v[j]);
+			}
+		}
+		static void setMask(Mask& mask, const bool* lane){
+			mask.m = 0;
+			for(size_t k = 0; k < lanes; k++){
+				mask.m |= (__mmask8)(lane[k] << k);
+			}
+		}
+		EC_LANES_IFMA static void set(Elem& z, const uint64_t (*l)[limbs], bool all = false){
+			for(size_t j = 0; j < limbs; j++){
+				z.v[j] = all ? _mm512_set1_epi64(l[0][j])
+					: _mm512_set_epi64(l[7][j], l[6][j], l[5][j], l[4][j], l[3][j], l[2][j], l[1][j], l[0][j]);
+			}
+		}
+		EC_LANES_IFMA static void get(uint64_t (*l)[limbs], const Elem& z){
+			uint64_t v[lanes];
+			for(size_t j = 0; j < limbs; j++){
+				_mm512_storeu_si512(v, z.v[j]);
+				for(size_t k = 0; k < lanes; k++){
+					l[k][j] = v[k];
+				}
+			}
+		}
+	};
+#endif
+
+	template<class F>
+	struct Point {
+		typename F::Elem x, y, z; //Jacobian
+	};
+
+	/*
+		points in: x below 2^268, y below 2^263, z below 2^259, points out the same
+		R = 2P, dbl-2009-l, a Z^4 is added to E unless a is zero
+	*/
+	template<class F>
+	static void dbl(Point<F>& R, const Point<F>& P){
+		const Param<F::limbs>& prm = F::param();
+		typename F::Elem A, B, C, D, E, T, X3, Y3;
+		F::fsqr(A, P.x);
+		F::fsqr(B, P.y);
+		F::fsqr(C, B);
+		F::fadd(T, P.x, B);
+		F::fsqr(T, T);
+		F::fadd(D, A, C);
+		F::fsub(D, T, D, prm.k1);
+		F::fadd(D, D, D); //< 2^264
+		F::fadd(E, A, A);
+		F::fadd(E, E, A);
+		if(!prm.a_zero){
+			typename F::Elem a;
+			F::set(a, &prm.a, true);
+			F::fsqr(T, P.z);
+			F::fsqr(T, T);
+			F::fmul(T, T, a);
+			F::fadd(E, E, T);
+		}
+		F::fsqr(X3, E);
+		F::fadd(T, D, D);
+		F::fsub(X3, X3, T, prm.k2);
+		F::fsub(T, D, X3, prm.k3);
+		F::fmul(Y3, E, T);
+		F::fadd(C, C, C);
+		F::fadd(C, C, C);
+		F::fadd(C, C, C);
+		F::fsub(Y3, Y3, C, prm.k1);
+		F::fmul(T, P.y, P.z);
+		F::fadd(R.z, T, T);
+		R.x = X3;
+		R.y = Y3;
+	}
+	//R = P + Q, add-2007-bl, P != +-Q
+	template<class F>
+	static void add(Point<F>& R, const Point<F>& P, const Point<F>& Q){
+		const Param<F::limbs>& prm = F::param();
+		typename F::Elem Z1Z1, Z2Z2, U1, U2, S1, S2, H, I, J, r, V, T;
+		F::fsqr(Z1Z1, P.z);
+		F::fsqr(Z2Z2, Q.z);
+		F::fmul(U1, P.x, Z2Z2);
+		F::fmul(U2, Q.x, Z1Z1);
+		F::fmul(S1, Q.z, Z2Z2);
+		F::fmul(S1, P.y, S1);
+		F::fmul(S2, P.z, Z1Z1);
+		F::fmul(S2, Q.y, S2);
+		F::fsub(H, U2, U1, prm.k1);
+		F::fadd(I, H, H);
+		F::fsqr(I, I);
+		F::fmul(J, H, I);
+		F::fsub(r, S2, S1, prm.k1);
+		F::fadd(r, r, r);
+		F::fmul(V, U1, I);
+		F::fmul(T, P.z, Q.z);
+		F::fmul(T, T, H);
+		F::fadd(R.z, T, T);
+		F::fsqr(T, r);
+		F::fadd(U2, V, V);
+		F::fadd(U2, U2, J);
+		F::fsub(R.x, T, U2, prm.k1);
+		F::fsub(T, V, R.x, prm.k2);
+		F::fmul(T, r, T);
+		F::fmul(S1, S1, J);
+		F::fadd(S1, S1, S1);
+		F::fsub(R.y, T, S1, prm.k1);
+	}
+	//R = P + Q for an affine Q (z of Q is ignored), madd-2007-bl, P != +-Q
+	template<class F>
+	static void madd(Point<F>& R, const Point<F>& P, const Point<F>& Q){
+		const Param<F::limbs>& prm = F::param();
+		typename F::Elem Z1Z1, U2, S2, H, I, J, r, V, W, T;
+		F::fsqr(Z1Z1, P.z);
+		F::fmul(U2, Q.x, Z1Z1);
+		F::fmul(S2, P.z, Z1Z1);
+		F::fmul(S2, Q.y, S2);
+		F::fsub(H, U2, P.x, prm.k3);
+		F::fsqr(I, H);
+		F::fadd(I, I, I);
+		F::fadd(I, I, I);
+		F::fmul(J, H, I);
+		F::fsub(r, S2, P.y, prm.k2);
+		F::fadd(r, r, r);
+		F::fmul(V, P.x, I);
+		F::fmul(T, P.y, J);
+		F::fadd(W, T, T);
+		F::fmul(T, P.z, H);
+		F::fadd(R.z, T, T);
+		F::fsqr(T, r);
+		F::fadd(U2, V, V);
+		F::fadd(U2, U2, J);
+		F::fsub(R.x, T, U2, prm.k1);
+		F::fsub(T, V, R.x, prm.k2);
+		F::fmul(T, r, T);
+		F::fsub(R.y, T, W, prm.k1);
+	}
+	//R = P in the lanes set in lane
+	template<class F>
+	static void blend(Point<F>& R, const Point<F>& P, const bool* lane){
+		typename F::Mask mask;
+		F::setMask(mask, lane);
+		F::blend(R.x, P.x, mask);
+		F::blend(R.y, P.y, mask);
+		F::blend(R.z, P.z, mask);
+	}
+
+	//lane k from *x[k]
+	template<class F>
+	static void load(typename F::Elem& z, const Fp* const* x){
+		uint64_t l[lanes][F::limbs];
+		for(size_t k = 0; k < lanes; k++){
+			unitsToLimbs(l[k], x[k]->getUnit(), F::bits, F::limbs);
+		}
+		typename F::Elem in;
+		F::set(z, l);
+		F::set(in, &F::param().in, true);
+		F::fmul(z, z, in);
+	}
+	//*x[k] from lane k, nonzero[k] false for lanes that are zero
+	template<class F>
+	static void store(Fp* const* x, const typename F::Elem& z, bool* nonzero){
+		const Param<F::limbs>& prm = F::param();
+		typename F::Elem one, t;
+		F::set(one, &prm.one, true);
+		F::fmul(t, z, one); //in [0, p]
+		uint64_t l[lanes][F::limbs];
+		F::get(l, t);
+		for(size_t k = 0; k < lanes; k++){
+			bool zero = true, is_p = true;
+			for(size_t j = 0; j < F::limbs; j++){
+				zero = zero && l[k][j] == 0;
+				is_p = is_p && l[k][j] == prm.p[j];
+			}
+			nonzero[k] = !zero && !is_p;
+			if(nonzero[k]){
+				uint64_t u[4];
+				limbsToUnits(u, l[k], F::bits, F::limbs);
+				x[k]->setArray(u, units());
+			}
+			else{
+				x[k]->clear();
+			}
+		}
+	}
+	template<class F>
+	static void loadPoints(Point<F>& R, Ec* const* P){
+		const Fp* x[lanes];
+		const Fp* y[lanes];
+		const Fp* z[lanes];
+		for(size_t k = 0; k < lanes; k++){
+			x[k] = &P[k]->x;
+			y[k] = &P[k]->y;
+			z[k] = &P[k]->z;
+		}
+		load<F>(R.x, x);
+		load<F>(R.y, y);
+		load<F>(R.z, z);
+	}
+	//nonzero[k] false for lanes that are zero, they are cleared
+	template<class F>
+	static void storePoints(Ec* const* P, const Point<F>& R, bool* nonzero){
+		Fp* x[lanes];
+		Fp* y[lanes];
+		Fp* z[lanes];
+		for(size_t k = 0; k < lanes; k++){
+			x[k] = &P[k]->x;
+			y[k] = &P[k]->y;
+			z[k] = &P[k]->z;
+		}
+		bool unused[lanes];
+		store<F>(z, R.z, nonzero);
+		store<F>(x, R.x, unused);
+		store<F>(y, R.y, unused);
+		for(size_t k = 0; k < lanes; k++){
+			if(!nonzero[k]){
+				P[k]->clear();
+			}
+		}
+	}
+
+	//*P[i] += Q, eight at a time, lanes that hit P = +-Q or a zero P are redone by mcl
+	template<class F>
+	static bool addLanes(Ec* const* P, size_t n, const Ec& Q){
+		Point<F> Q8;
+		const Fp* qx[lanes];
+		const Fp* qy[lanes];
+		for(size_t k = 0; k < lanes; k++){
+			qx[k] = &Q.x;
+			qy[k] = &Q.y;
+		}
+		load<F>(Q8.x, qx);
+		load<F>(Q8.y, qy);
+		for(size_t i = 0; i < n; i += lanes){
+			Ec pad[lanes], orig[lanes];
+			Ec* L[lanes];
+			for(size_t k = 0; k < lanes; k++){
+				L[k] = i + k < n ? P[i + k] : &pad[k];
+				orig[k] = *L[k];
+			}
+			Point<F> R;
+			loadPoints<F>(R, L);
+			madd<F>(R, R, Q8);
+			bool nonzero[lanes];
+			storePoints<F>(L, R, nonzero);
+			for(size_t k = 0; k < lanes && i + k < n; k++){
+				if(!nonzero[k]){
+					Ec::add(*L[k], orig[k], Q);
+				}
+			}
+		}
+		return true;
+	}
+	/*
+		*P[i] *= x[i], eight at a time, in constant time: 4-bit windows of all 64 bits, every window
+		selects its multiple from a table of 15 by masks and adds it, lanes whose digit is 0 discard
+		the sum, the multiples of a base are distinct from the partial sums, so that no addition
+		doubles, zero bases stay zero since every z is a multiple of theirs
+	*/
+	template<class F>
+	static bool mulLanes(Ec* const* P, size_t n, const uint64_t* x){
+		for(size_t i = 0; i < n; i++){
+			if(!P[i]->isNormalized()){
+				return false;
+			}
+		}
+		for(size_t i = 0; i < n; i += lanes){
+			Ec pad[lanes];
+			Ec* L[lanes];
+			uint64_t s[lanes];
+			for(size_t k = 0; k < lanes; k++){
+				L[k] = i + k < n ? P[i + k] : &pad[k];
+				s[k] = i + k < n ? x[i + k] : 0;
+			}
+			Point<F> T[16];
+			loadPoints<F>(T[1], L);
+			dbl<F>(T[2], T[1]);
+			for(size_t k = 3; k < 16; k++){
+				madd<F>(T[k], T[k - 1], T[1]);
+			}
+			Point<F> acc = T[1], Q, S;
+			F::set(acc.z, &F::param().zero, true);
+			bool started[lanes] = {false};
+			for(int w = 15; w >= 0; w--){
+				if(w < 15){
+					for(int b = 0; b < 4; b++){
+						dbl<F>(acc, acc);
+					}
+				}
+				bool digit[16][lanes], sum[lanes], first[lanes];
+				for(size_t k = 0; k < lanes; k++){
+					const uint64_t d = (s[k] >> (4 * w)) & 15;
+					for(uint64_t e = 0; e < 16; e++){
+						digit[e][k] = d == e;
+					}
+					sum[k] = started[k] & !digit[0][k];
+					first[k] = !started[k] & !digit[0][k];
+					started[k] = started[k] | !digit[0][k];
+				}
+				Q = T[1];
+				for(int k = 2; k < 16; k++){
+					blend<F>(Q, T[k], digit[k]);
+				}
+				add<F>(S, acc, Q);
+				blend<F>(acc, S, sum);
+				blend<F>(acc, Q, first);
+			}
+			bool nonzero[lanes];
+			storePoints<F>(L, acc, nonzero);
+		}
+		return true;
+	}
+};
+
+template<class Elgamal>
+typename EcLanes<Elgamal>::Isa EcLanes<Elgamal>::init(Isa max){
+#ifdef EC_LANES_X86
+	if(Ec::mode_ != mcl::ec::Jacobi || Fp::getBitSize() > 256 || sizeof(*Fp().getUnit()) != 8){
+		return none;
+	}
+	units() = (Fp::getBitSize() + 63) / 64;
+	__builtin_cpu_init();
+	typename Elgamal::CipherText::LaneBackend backend = {0, 0};
+	Isa isa = none;
+	if(max >= avx512ifma && __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512ifma")){
+		initParam<Ifma>();
+		backend.add = addLanes<Ifma>;
+		backend.mul = mulLanes<Ifma>;
+		isa = avx512ifma;
+	}
+	else if(max >= avx2 && __builtin_cpu_supports("avx2")){
+		initParam<Avx2>();
+		backend.add = addLanes<Avx2>;
+		backend.mul = mulLanes<Avx2>;
+		isa = avx2;
+	}
+	if(isa != none){
+		Elgamal::CipherText::setLaneBackend(backend);
+	}
+	return isa;
+#else
+	return none;
+#endif
+}
+
+#endif // EC_LANES_H_INCLUDED
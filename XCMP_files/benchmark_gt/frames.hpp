@@ -0,0 +1,95 @@
+/**
+ \file 		frames.hpp
+ \author 	kiss@encrypto.cs.tu-darmstadt.de
+ \copyright	Ciphertext frames
+			Copyright (C) 2019 Cryptography and Privacy Engineering Group, TU Darmstadt
+			This program is free software: you can redistribute it and/or modify
+			it under the terms of the GNU Affero General Public License as published
+			by the Free Software Foundation, either version 3 of the License, or
+			(at your option) any later version.
+			This program is distributed in the hope that it will be useful,
+			but WITHOUT ANY WARRANTY; without even the implied warranty of
+			MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+			GNU Affero General Public License for more details.
+			You should have received a copy of the GNU Affero General Public License
+			along with this program. If not, see <http://www.gnu.org/licenses/>.
+ \brief		Binary frames of ElGamal ciphertexts as exchanged by the HHH parties, encoded and decoded
+			independently of the connection.
+ */
+
+#ifndef FRAMES_H_INCLUDED
+#define FRAMES_H_INCLUDED
+
+#include <stdint.h>
+#include <vector>
+#include "curve.hpp"
+
+/*
+	ciphertexts are sent as one binary frame per vector:
+	tag | number of ciphertexts (4 bytes) | bytes per ciphertext (4 bytes) | fixed-width ciphertexts
+	integers are little endian, see ElgamalT::CipherText::saveFixed for the ciphertext encoding
+	if both parties agree on compressed frames at session start (see COMPRESS), ciphertexts are encoded by
+	ElgamalT::CipherText::saveCompressed instead, which roughly halves the frames, the receiver accepts the
+	negotiated encoding only and tells the encodings apart by the bytes per ciphertext
+	the tag is 'F'
+*/
+const char frame_tag = 'F';
+const size_t frame_header_len = 9;
+
+inline void put_uint32(char* buf, uint32_t x){
+	for(uint32_t i = 0; i < 4; i++){
+		buf[i] = (char)(x >> (8 * i));
+	}
+}
+
+inline uint32_t get_uint32(const char* buf){
+	uint32_t x = 0;
+	for(uint32_t i = 0; i < 4; i++){
+		x |= (uint32_t)(uint8_t)buf[i] << (8 * i);
+	}
+	return x;
+}
+
+//bytes per ciphertext of compressed or fixed frames
+inline size_t frame_ctxt_len(bool compressed){
+	return compressed ? Elgamal::CipherText::getCompressedByteSize() : Elgamal::CipherText::getFixedByteSize();
+}
+
+//frame of ctxts into buf, header included
+inline void encode_frame(std::vector<char> &buf, std::vector<Elgamal::CipherText> const& ctxts, char tag, bool compressed)
+{
+	static thread_local std::vector<Elgamal::CipherText> affine;
+	const size_t ctxt_len = frame_ctxt_len(compressed);
+	buf.resize(frame_header_len + ctxts.size() * ctxt_len);
+	buf[0] = tag;
+	put_uint32(&buf[1], ctxts.size());
+	put_uint32(&buf[5], ctxt_len);
+	affine.assign(ctxts.begin(), ctxts.end());
+	Elgamal::CipherText::batchNormalize(affine); //one inversion per frame instead of two per ciphertext
+	for (size_t i = 0; i < affine.size(); i++){
+		if(compressed){
+			affine[i].saveCompressed(&buf[frame_header_len + i * ctxt_len]);
+		}
+		else{
+			affine[i].saveFixed(&buf[frame_header_len + i * ctxt_len]);
+		}
+	}
+}
+
+//decodes all ciphertexts of a frame, a compressed one costs a square root per point
+inline void decode_ctxts(const char* frame, std::vector<Elgamal::CipherText> &ctxts)
+{
+	const uint32_t count = get_uint32(&frame[1]);
+	const size_t ctxt_len = get_uint32(&frame[5]);
+	const char* payload = frame + frame_header_len;
+	ctxts.resize(count);
+	if (ctxt_len == Elgamal::CipherText::getCompressedByteSize()){
+		if (count > 0)
+			Elgamal::CipherText::loadCompressed(&ctxts[0], count, payload);
+		return;
+	}
+	for (uint32_t i = 0; i < count; i++)
+		ctxts[i].loadFixed(payload + i * ctxt_len);
+}
+
+#endif // FRAMES_H_INCLUDED
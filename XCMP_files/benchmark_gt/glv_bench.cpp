@@ -0,0 +1,261 @@
+/**
+ \file 		glv_bench.cpp
+ \author 	kiss@encrypto.cs.tu-darmstadt.de
+ \copyright	GLV benchmark
+			Copyright (C) 2019 Cryptography and Privacy Engineering Group, TU Darmstadt
+			This program is free software: you can redistribute it and/or modify
+			it under the terms of the GNU Affero General Public License as published
+			by the Free Software Foundation, either version 3 of the License, or
+			(at your option) any later version.
+			This program is distributed in the hope that it will be useful,
+			but WITHOUT ANY WARRANTY; without even the implied warranty of
+			MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+			GNU Affero General Public License for more details.
+			You should have received a copy of the GNU Affero General Public License
+			along with this program. If not, see <http://www.gnu.org/licenses/>.
+ \brief		Compares variable-base scalar multiplication on secp256k1 with and without the GLV
+			endomorphism: full-width scalars and the 64-bit blinding scalars of the server.
+			HHH has no full-width variable-base multiplication by a public scalar, the blinding scalars
+			are 64 bits and the private key goes through ElgamalT::mulRegular, so GLV lives in this
+			benchmark only. Other groups of HHH_CURVE are skipped
+ */
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <sys/time.h>
+#include "curve.hpp"
+#include "drbg.hpp"
+
+using namespace std;
+
+const size_t num_muls = 1000;
+
+AesCtrDrbg rg;
+
+double elapsed_us(const timeval& tbegin, const timeval& tend){
+	return (tend.tv_sec - tbegin.tv_sec) * 1000000.0 + tend.tv_usec - tbegin.tv_usec;
+}
+
+const int naf_width = 5;
+
+//width-w NAF of k, least significant digit first, a nonzero digit is odd and followed by w-1 zeros
+void recodeNaf(vector<int8_t>& naf, const mpz_class& k){
+	naf.clear();
+	const bool neg = k < 0;
+	const mpz_class a = neg ? mpz_class(-k) : k;
+	const size_t bitSize = a == 0 ? 0 : mcl::gmp::getBitSize(a);
+	vector<uint32_t> w(bitSize / 32 + 2, 0); //little endian, one spare word for carries
+	for(size_t i = 0; i < bitSize; i++){
+		if(mcl::gmp::testBit(a, i)){
+			w[i / 32] |= 1u << (i % 32);
+		}
+	}
+	const int half = 1 << (naf_width - 1);
+	for(;;){
+		size_t top = w.size();
+		while(top > 0 && w[top - 1] == 0){
+			top--;
+		}
+		if(top == 0){
+			break;
+		}
+		int d = 0;
+		if(w[0] & 1){
+			d = int(w[0] & ((1u << naf_width) - 1));
+			if(d >= half){
+				d -= 2 * half;
+			}
+			if(d > 0){
+				w[0] -= uint32_t(d); //the low bits of w are d, no borrow
+			}
+			else{
+				uint64_t carry = uint32_t(-d);
+				for(size_t i = 0; carry && i < w.size(); i++){
+					carry += w[i];
+					w[i] = uint32_t(carry);
+					carry >>= 32;
+				}
+			}
+		}
+		naf.push_back(int8_t(neg ? -d : d));
+		for(size_t i = 0; i < w.size(); i++){
+			w[i] = (w[i] >> 1) | (i + 1 < w.size() ? w[i + 1] << 31 : 0);
+		}
+	}
+}
+
+/**
+ * GLV method for secp256k1 (y^2 = x^3 + 7): phi(x, y) = (beta x, y) is P^lambda for a cube root of
+ * unity beta mod p and lambda mod n, k is split into k1 + k2 lambda mod n with |k1|, |k2| < 2^129,
+ * and P^k = P^k1 phi(P)^k2 takes about half the doublings of a full-width P^k
+ */
+struct Glv {
+	Fp beta;
+	mpz_class n, lambda, a1, b1, a2, b2;
+
+	//false if the group is not secp256k1 or phi(P) != P^lambda for P of order n
+	bool init(const Ec& P){
+		mcl::gmp::setStr(n, "fffffffffffffffffffffffffffffffebaaedce6af48a03bbfd25e8cd0364141", 16);
+		mcl::gmp::setStr(lambda, "5363ad4cc05c30e0a5261c028812645a122e22ea20816678df02967c1b23bd72", 16);
+		mcl::gmp::setStr(a1, "3086d221a7d46bcde86c90e49284eb15", 16);
+		mcl::gmp::setStr(b1, "-e4437ed6010e88286f547fa90abfe4c3", 16);
+		mcl::gmp::setStr(a2, "114ca50f7a8e2f3f657c1108d9d44cfd8", 16);
+		b2 = a1;
+		string str;
+		Zn::getModulo(str);
+		mpz_class order;
+		mcl::gmp::setStr(order, str, 10);
+		if(order != n || P.isZero()){
+			return false;
+		}
+		beta.setStr("0x7ae96a2b657c07106e64479eac3434e99cf0497512f58995c1396c28719501ee");
+		Fp beta3;
+		Fp::sqr(beta3, beta);
+		Fp::mul(beta3, beta3, beta);
+		if(!beta3.isOne()){
+			return false;
+		}
+		Ec phiP, lambdaP;
+		endo(phiP, P);
+		Ec::mul(lambdaP, P, lambda);
+		return phiP == lambdaP;
+	}
+
+	//phi(P) for P in Jacobian or projective coordinates, only x is scaled
+	void endo(Ec& Q, const Ec& P) const {
+		Q = P;
+		Fp::mul(Q.x, P.x, beta);
+	}
+
+	//k = k1 + k2 lambda mod n with c1 = round(b2 k / n), c2 = round(-b1 k / n)
+	void split(mpz_class& k1, mpz_class& k2, const mpz_class& k) const {
+		mpz_class r = k % n;
+		if(r < 0){
+			r += n;
+		}
+		const mpz_class c1 = (2 * b2 * r + n) / (2 * n);
+		const mpz_class c2 = (-2 * b1 * r + n) / (2 * n);
+		k1 = r - c1 * a1 - c2 * a2;
+		k2 = -c1 * b1 - c2 * b2;
+	}
+
+	//z = P^k by a joint NAF walk over both halves, with the odd powers of P and phi(P) on the stack
+	void mul(Ec& z, const Ec& P, const mpz_class& k) const {
+		mpz_class k1, k2;
+		split(k1, k2, k);
+		vector<int8_t> naf1, naf2;
+		recodeNaf(naf1, k1);
+		recodeNaf(naf2, k2);
+		const size_t tbl_num = 1 << (naf_width - 2);
+		Ec tbl1[tbl_num], tbl2[tbl_num], P2;
+		tbl1[0] = P;
+		Ec::dbl(P2, P);
+		for(size_t i = 1; i < tbl_num; i++){
+			Ec::add(tbl1[i], tbl1[i - 1], P2);
+		}
+		for(size_t i = 0; i < tbl_num; i++){
+			endo(tbl2[i], tbl1[i]);
+		}
+		Ec t;
+		t.clear();
+		for(size_t i = std::max(naf1.size(), naf2.size()); i > 0; i--){
+			Ec::dbl(t, t);
+			const int d1 = i <= naf1.size() ? naf1[i - 1] : 0;
+			const int d2 = i <= naf2.size() ? naf2[i - 1] : 0;
+			if(d1 > 0){
+				Ec::add(t, t, tbl1[d1 >> 1]);
+			}
+			else if(d1 < 0){
+				Ec::sub(t, t, tbl1[-d1 >> 1]);
+			}
+			if(d2 > 0){
+				Ec::add(t, t, tbl2[d2 >> 1]);
+			}
+			else if(d2 < 0){
+				Ec::sub(t, t, tbl2[-d2 >> 1]);
+			}
+		}
+		z = t;
+	}
+};
+
+Glv glv;
+
+//full-width scalars, Ec::mul against GLV
+void benchFullWidth(const vector<Ec>& points){
+	vector<Zn> k(points.size());
+	for(size_t i = 0; i < k.size(); i++){
+		k[i].setRand(rg);
+	}
+	vector<Ec> plain(points.size()), res(points.size());
+	timeval tbegin, tend;
+	gettimeofday(&tbegin, NULL);
+	for(size_t i = 0; i < points.size(); i++){
+		Ec::mul(plain[i], points[i], k[i]);
+	}
+	gettimeofday(&tend, NULL);
+	const double t_plain = elapsed_us(tbegin, tend);
+	gettimeofday(&tbegin, NULL);
+	for(size_t i = 0; i < points.size(); i++){
+		mpz_class m;
+		k[i].getMpz(m);
+		glv.mul(res[i], points[i], m);
+	}
+	gettimeofday(&tend, NULL);
+	const double t_glv = elapsed_us(tbegin, tend);
+	size_t mismatches = 0;
+	for(size_t i = 0; i < points.size(); i++){
+		mismatches += !(plain[i] == res[i]);
+	}
+	cout << "256-bit scalars: Ec::mul " << t_plain / points.size() << "us, GLV " << t_glv / points.size()
+		<< "us (" << mismatches << " mismatches)" << endl;
+}
+
+//64-bit blinding scalars as in calculatePathCosts, GLV halves are 64 and 0 bits long here
+void benchBlinding(const vector<Ec>& points){
+	vector<uint64_t> k(points.size());
+	for(size_t i = 0; i < k.size(); i++){
+		k[i] = rg.get64();
+	}
+	vector<Ec> plain(points.size()), res(points.size());
+	timeval tbegin, tend;
+	gettimeofday(&tbegin, NULL);
+	for(size_t i = 0; i < points.size(); i++){
+		Ec::mul(plain[i], points[i], k[i]);
+	}
+	gettimeofday(&tend, NULL);
+	const double t_plain = elapsed_us(tbegin, tend);
+	gettimeofday(&tbegin, NULL);
+	for(size_t i = 0; i < points.size(); i++){
+		glv.mul(res[i], points[i], mpz_class((unsigned long)k[i]));
+	}
+	gettimeofday(&tend, NULL);
+	const double t_glv = elapsed_us(tbegin, tend);
+	size_t mismatches = 0;
+	for(size_t i = 0; i < points.size(); i++){
+		mismatches += !(plain[i] == res[i]);
+	}
+	cout << "64-bit scalars:  Ec::mul " << t_plain / points.size() << "us, GLV " << t_glv / points.size()
+		<< "us (" << mismatches << " mismatches)" << endl;
+}
+
+int main(int argc, char *argv[]) {
+	HHHGroup::init();
+	const Ec P = HHHGroup::generator();
+	if(!glv.init(P)){
+		cout << HHHGroup::name() << ": skipped, no GLV endomorphism" << endl;
+		return 0;
+	}
+	cout << HHHGroup::name() << ", " << num_muls << " multiplications" << endl;
+
+	vector<Ec> points(num_muls);
+	for(size_t i = 0; i < points.size(); i++){
+		Zn r;
+		r.setRand(rg);
+		Ec::mul(points[i], P, r);
+	}
+	benchFullWidth(points);
+	benchBlinding(points);
+	return 0;
+}
@@ -33,459 +33,1354 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <thread>
+#include <chrono>
+#include <memory>
+#include <functional>
+#include <array>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <dirent.h>
 
 #include "network.hpp"
+#include "curve.hpp"
 #include "dectree.hpp"
+#include "worker_pool.hpp"
+#include "bit_pool.hpp"
+#include "offline_service.hpp"
+#include "offline_store.hpp"
+#include "window_cache.hpp"
+#include "ec_lanes.hpp"
+#include "drbg.hpp"
+#include "model_registry.hpp"
+#include "frames.hpp"
+#include "pvt_cmp.hpp"
 #define PROT 0 //0 for HHH, 1 for HH(G), 2 for (GG)/(HG)H where the parts in brackets are executed outside of this code before/after
+#define STREAM 0 //1 to let the client return every comparison bit as soon as its result is in and fold it into the path costs at once (PROT 0 only), see PathFolder
+#define LANES 0 //1 (AVX2) or 2 (AVX-512 IFMA, else AVX2) to run batchAdd and batchMul in the lanes of ec_lanes.hpp, only if lanes_bench shows they beat mcl
+#define COMPRESS 1 //1 to offer/accept compressed ciphertext frames, used if both parties set it, see Channel
 #define DT 0 //0 for wine", 1 for iris, 2 for breast cancer, 3 for digits, 4 for diabetes, 5 for linnerud, 6 for boston
 
-typedef mcl::FpT<> Fp;
-typedef mcl::FpT<mcl::ZnTag> Zn; // use ZnTag because Zn is different class with Fp
-typedef mcl::EcT<Fp> Ec;
-typedef mcl::ElgamalT<Ec, Zn> Elgamal;
+thread_local AesCtrDrbg rg; //one generator per thread, seeded on first use
 
-cybozu::RandomGenerator rg;
-
-const uint32_t bitlen = 64;
 uint32_t ElGamalBits = 514;
 uint32_t Buflen = ElGamalBits / 8 + 1; //size of one ciphertext to send via network. Paillier uses n bits == n/8 bytes
+uint32_t cmp_threads = std::thread::hardware_concurrency(); //worker threads of the server-side comparison engine, 2nd command line argument
 
 using namespace std;
 
+/*
+	fixed-base window tables of public keys are cached in window_dir if it exists, see window_cache.hpp,
+	and shared by all sessions and processes of this user that load the same key, a key gets a table file
+	the second time it is loaded, so per-run client keys never do
+*/
+const string window_dir = "../../../window_cache";
+const size_t window_size = 10; //26 windows of 2^10 - 1 points per table of a 256-bit key, about 11.5MB per key with 72-byte Fp, as without cache
+const size_t window_keys = 8; //keys mapped at most, the least recently used mapping is dropped for a new key
+const size_t window_files = 16; //table files kept in window_dir, the least recently used are removed
+std::unique_ptr< WindowCache<Elgamal> > window_cache;
+const uint32_t daemon_sessions = 8; //concurrent sessions of the server daemon, 3rd command line argument
+const string model_dir = "../../../UCI_dectrees"; //models served by the daemon, see model_registry.hpp
+const uint32_t model_poll_seconds = 10; //interval in which the daemon looks for new model versions
+const size_t batch_parallel_min = 256; //batch encryptions of at least this many ciphertexts use cmp_threads threads
+const int64_t max_label = 1 << 20; //leaf labels are decrypted by BSGS over at most [-max_label, max_label]
+const uint32_t stream_lag = 16; //STREAM: comparison results sent ahead of the reencrypted bit read back, see PvtCmpSParallel
+
+bool provideWindowTables(Elgamal::PublicKey& pub){
+	return window_cache && window_cache->provide(pub);
+}
+
 void SysInit()
 {
-	const mcl::EcParam& para = mcl::ecparam::secp256k1;
-	Zn::init(para.n);
-	Fp::init(para.p);
-	Ec::init(para.a, para.b);
+	HHHGroup::init(); //the group of HHH_CURVE, see curve.hpp
+	Elgamal::PublicKey::setBatchParallel(cmp_threads, batch_parallel_min); //offline encryptions of large trees
+#if LANES
+	EcLanes<Elgamal>::init((EcLanes<Elgamal>::Isa)LANES); //batchAdd and batchMul on eight points at once if the CPU has the instructions
+#endif
+	if(WindowCache<Elgamal>::prepareDir(window_dir)){
+		window_cache.reset(new WindowCache<Elgamal>(window_dir, window_size, window_keys, window_files));
+		Elgamal::PublicKey::setWindowProvider(provideWindowTables);
+	}
 }
 
 //NETWORK BEGIN
 
+//ciphertexts are sent as binary frames, see frames.hpp for the layout
+
+//connection of one session and the frame encoding negotiated at its start, text messages go to conn directly
+struct Channel {
+	tcp::iostream& conn;
+	bool compressed;
+};
+
 void send_ctxts(std::vector<Elgamal::CipherText> const& ctxts,
-		tcp::iostream &conn)
+		const Channel &ch)
 {
-	for (const auto &ctx : ctxts)
-		conn << ctx << '\n';
+	static thread_local std::vector<char> buf;
+	encode_frame(buf, ctxts, frame_tag, ch.compressed);
+	ch.conn.write(buf.data(), buf.size());
+	ch.conn.flush();
+}
+
+/**
+ * Reads the next frame, which must hold num ciphertexts, and returns it including the header, it stays
+ * valid until the next call in the same thread. Other frames are rejected before anything is allocated
+ * for them, the peer may be untrusted.
+ */
+const char* receive_frame(int32_t num, const Channel &ch)
+{
+	tcp::iostream &conn = ch.conn;
+	static thread_local std::vector<char> buf;
+	buf.resize(frame_header_len);
+	conn >> std::ws; //skip separators left over from the text-encoded setup messages
+	conn.read(buf.data(), frame_header_len);
+	const uint32_t count = get_uint32(&buf[1]);
+	const size_t ctxt_len = get_uint32(&buf[5]);
+	if (!conn || buf[0] != frame_tag || count != (uint32_t)num || ctxt_len != frame_ctxt_len(ch.compressed))
+		throw cybozu::Exception("hhh:receive_ctxts:bad frame") << count << num << ctxt_len;
+	buf.resize(frame_header_len + count * ctxt_len);
+	conn.read(&buf[frame_header_len], count * ctxt_len);
+	if (!conn)
+		throw cybozu::Exception("hhh:receive_ctxts:connection closed");
+	return buf.data();
 }
 
 void receive_ctxts(std::vector<Elgamal::CipherText> &ctxts, int32_t num,
-		tcp::iostream &conn)
+		const Channel &ch)
 {
-	ctxts.resize(num);
-	for (int32_t i = 0; i < num; i++)
-		conn >> ctxts[i];
+	decode_ctxts(receive_frame(num, ch), ctxts);
 }
 
 //NETWORK END
 
 //COMPARISON PROTOCOL BEGIN
 
-vector<Elgamal::CipherText> encBitbyBitPrecomp(const Elgamal::PublicKey& pub){
-	vector<Elgamal::CipherText> xenc(bitlen);
-	for(int32_t i = bitlen - 1; i >= 0; --i){
-		pub.enc_off(xenc[bitlen - i - 1], rg);
+/**
+ * Online encryption without EC operations: takes the W bit encryptions of x from the pool
+ */
+template<uint32_t W>
+void encBitbyBitPool(BitCipherPool<Elgamal>& pool, vector<Elgamal::CipherText>& xenc, uint64_t x){
+	xenc.resize(W);
+	for(int32_t i = W - 1; i >= 0; --i){
+		pool.take(xenc[W - i - 1], (x >> i) & 1);
 	}
-	return xenc;
 }
 
-void encBitbyBitOnline(const Elgamal::PublicKey& pub, vector<Elgamal::CipherText>& xenc, uint64_t x){
-	int bit;
-	for(int32_t i = bitlen - 1; i >= 0; --i){
-		bit = (x >> i) & 1;
-		pub.enc_on(xenc[bitlen - i - 1], bit);
+/**
+ * encBitbyBitPool on bits = 8, 16, 32 or 64 bits, where x is saturated to 2^bits - 1.
+ * All thresholds of the attribute are below that value, so no comparison result changes.
+ */
+void encBitsPool(BitCipherPool<Elgamal>& pool, vector<Elgamal::CipherText>& xenc, uint64_t x, uint32_t bits){
+	if(bits < 64 && x > (1ULL << bits) - 1){
+		x = (1ULL << bits) - 1;
 	}
-}
-
-vector<Elgamal::CipherText> encBitbyBit(const Elgamal::PublicKey& pub, uint64_t x){
-	vector<Elgamal::CipherText> xenc(bitlen);
-	int bit;
-	for(int32_t i = bitlen - 1; i >= 0; --i){
-		bit = (x >> i) & 1;
-		pub.enc(xenc[bitlen - i - 1], bit, rg);
+	switch(bits){
+	case 8: encBitbyBitPool<8>(pool, xenc, x); break;
+	case 16: encBitbyBitPool<16>(pool, xenc, x); break;
+	case 32: encBitbyBitPool<32>(pool, xenc, x); break;
+	default: encBitbyBitPool<64>(pool, xenc, x); break;
 	}
-	return xenc;
 }
 
-vector<int> getBits(uint64_t number){
-	vector<int> bits(bitlen);
-	for(uint32_t i = 0; i < bitlen; ++i){
-		bits[i] = (number >> (bitlen-i-1)) & 1;   
+/**
+ * Comparison plan of a compiled tree: one trie per attribute and, per distinct comparison, the trie nodes
+ * of its threshold prefixes. Every comparison returns max_bits ciphertexts to the client, those of narrower
+ * attributes are padded so that the client cannot tell which attribute a comparison uses.
+ * Depends on the tree only and is built once.
+ */
+struct CmpPlan {
+	vector<ThresholdTrie> tries; //indexed by attribute index
+	vector< vector<uint32_t> > paths; //indexed by comparison
+	vector<uint32_t> padding; //indexed by comparison
+	uint32_t max_bits;
+};
+
+void buildCmpPlan(const DecTree& tree, CmpPlan& plan){
+	plan.tries.assign(tree.num_attributes, ThresholdTrie());
+	plan.paths.resize(tree.num_cmps);
+	plan.padding.resize(tree.num_cmps);
+	plan.max_bits = *std::max_element(tree.attribute_bits.begin(), tree.attribute_bits.end());
+	for(uint32_t c = 0; c < tree.num_cmps; c++){
+		const uint32_t bits = tree.attribute_bits[tree.cmp_attributes[c]];
+		plan.tries[tree.cmp_attributes[c]].insert(tree.cmp_thresholds[c], bits, plan.paths[c]);
+		plan.padding[c] = plan.max_bits - bits;
 	}
-	return bits;
 }
+//receives the reencrypted comparison bits of STREAM one at a time, see PvtCmpSParallel
+typedef std::function<void(const Elgamal::CipherText&)> ReencHandler;
 
-Elgamal::CipherText xorWithConst(const Elgamal::PublicKey& pub, Elgamal::CipherText toXor, int thres){
-	Elgamal::CipherText result(toXor);
-	if(thres == 1){
-		result.neg();
-		pub.add(result, 1);
+/**
+ * Runs the distinct comparisons of the compiled tree on the worker pool, where every worker draws its
+ * randomness from its own generator rngs[worker]. First the xor prefix sums of the attribute tries are
+ * computed, then the per comparison results. The results are sent in comparison order as soon as the
+ * respective comparison is done, so the client receives them exactly as in the sequential version.
+ * Without ch the results are only kept in gt_results.
+ * With on_reenc (STREAM) the client answers every result with its reencrypted comparison bit, which is read
+ * stream_lag results later, so neither party blocks on a full socket buffer, and handed to on_reenc in
+ * comparison order. All I/O of the session and on_reenc run on the calling thread.
+ * prefixes holds the prefix sums of the previous query of the session, only those of the attributes
+ * flagged in fresh are computed anew. Every comparison result is built from the fresh server bit, tmpsum
+ * and padding, whether its attribute changed or not.
+ */
+void PvtCmpSParallel(const Elgamal::PublicKey& pub, vector<Elgamal::CipherText>& tmpsum, const vector< vector<Elgamal::CipherText> >& padding,
+		const vector< vector<Elgamal::CipherText> >& ctxts, vector< vector<Elgamal::CipherText> >& prefixes, const vector<bool>& fresh,
+		const DecTree& tree, const CmpPlan& plan, const vector<uint64_t>& server_bits,
+		vector< vector<Elgamal::CipherText> >& gt_results, WorkerPool& pool, AesCtrDrbg* rngs, const Channel* ch,
+		const ReencHandler& on_reenc = ReencHandler()){
+	prefixes.resize(plan.tries.size());
+	OrderedCompletion tries_done(plan.tries.size());
+	for(uint32_t a = 0; a < plan.tries.size(); a++){ //submitted first, so node jobs only wait for tries already taken by a worker
+		if(!fresh[a] || plan.tries[a].size() == 1){ //unchanged, or no comparison on the attribute
+			tries_done.finish(a);
+			continue;
+		}
+		pool.submit([&, a](uint32_t worker){
+			trieXorPrefixes(pub, plan.tries[a], ctxts[a], prefixes[a], rngs[worker]);
+			tries_done.finish(a);
+		});
 	}
-	else{
-		pub.rerandomize(result, rg);
+	OrderedCompletion completion(tree.num_cmps);
+	for(uint32_t c = 0; c < tree.num_cmps; c++){
+		pool.submit([&, c](uint32_t worker){
+			const uint32_t a = tree.cmp_attributes[c];
+			tries_done.wait(a);
+			gt_results[c] = PvtCmpSBits(tree.attribute_bits[a], pub, tmpsum[c], ctxts[a], prefixes[a], plan.paths[c],
+				tree.cmp_thresholds[c], server_bits[c], padding[c], rngs[worker]);
+			completion.finish(c);
+		});
+	}
+	vector<Elgamal::CipherText> bit;
+	auto wait_all = [&](){ //no job may outlive the locals it refers to
+		for(uint32_t c = 0; c < tree.num_cmps; c++){
+			completion.wait(c);
+		}
+		for(uint32_t a = 0; a < plan.tries.size(); a++){
+			tries_done.wait(a);
+		}
+	};
+	try{
+		for(uint32_t i = 0; i < tree.num_cmps; i++){
+			completion.wait(i);
+			if(!ch){
+				continue;
+			}
+			send_ctxts(gt_results[i], *ch);
+			if(on_reenc && i >= stream_lag){
+				receive_ctxts(bit, 1, *ch);
+				on_reenc(bit[0]);
+			}
+		}
+		for(uint32_t i = tree.num_cmps - std::min(tree.num_cmps, stream_lag); on_reenc && i < tree.num_cmps; i++){ //the last ones
+			receive_ctxts(bit, 1, *ch);
+			on_reenc(bit[0]);
+		}
 	}
-	return result;
+	catch(...){
+		wait_all();
+		throw;
+	}
+	wait_all();
 }
 
-vector<Elgamal::CipherText> PvtCmpS(const Elgamal::PublicKey& pub, Elgamal::CipherText& tmpsum, vector<Elgamal::CipherText> xenc, int64_t threshold, int server_bit){
-	vector<Elgamal::CipherText> result(bitlen); 
-	vector<int> yBits =  getBits(threshold); 
-	int32_t s = 1-2*server_bit; //BINDER
-	Elgamal::CipherText currentRes, xorRes;
+//decryption, all ciphertexts are zero-tested in one batch
+int32_t PvtCmpC(const Elgamal::PrivateKey& prv, const vector<Elgamal::CipherText>& c){
+	return prv.findZeroMessage(c) < c.size() ? 1 : 0;
+}
+
+//COMPARISON PROTOCOL END
+
+//EVALUATION PROTOCOL BEGIN
 
-	for(uint32_t i = 0; i < bitlen; ++i){
-		currentRes = xenc[i];
-		pub.add(currentRes, s - yBits[i]); // x_i - y_i + s (latter two values known to server)
-		xorRes = xorWithConst(pub, xenc[i], yBits[i]); //y_i + x_i
-		xorRes.mul(3); //*3
-		if(i > 0){
-			currentRes.add(tmpsum);
+//all leaves are blinded in one batch, the classifications are added to classif
+void blindLeaves(const Elgamal::PublicKey& pub, const DecTree& tree, vector<Elgamal::CipherText>& pathCost,
+		vector<Elgamal::CipherText>& classif, vector<uint64_t>& rand1, vector<uint64_t>& rand2){
+	Elgamal::CipherText::batchMul(pathCost.data(), pathCost.size(), rand1.data());
+	Elgamal::CipherText::batchMul(classif.data(), classif.size(), rand2.data());
+	uint32_t k = 0;
+	for(uint32_t j = 0; j < tree.node_vec.size(); j++){
+		if(tree.node_vec[j]->leaf){
+			pub.add(classif[k], tree.node_vec[j]->classification);
+			k++;
 		}
-		tmpsum.add(xorRes);
-		result[i] = currentRes;
 	}
-	std::random_shuffle(result.begin(), result.end());
-	return result;
 }
 
-//decryption
-int32_t PvtCmpC(const Elgamal::PrivateKey& prv, vector<Elgamal::CipherText> c){
-	for(uint32_t i = 0; i < bitlen; ++i){
-		if(prv.isZeroMessage(c[i])){
-			return 1;
+/*
+	the tree is only read, the path costs of an evaluation are kept in an array of its own indexed by
+	Node::id, so any number of sessions evaluate the same tree concurrently
+*/
+void calculatePathCosts(const Elgamal::PublicKey& pub, const DecTree& tree, vector<Elgamal::CipherText>& pathCost,
+		vector<Elgamal::CipherText>& classif, vector<Elgamal::CipherText>& edgeCost0,
+		vector<Elgamal::CipherText>& edgeCost1, vector<uint64_t>& rand1, vector<uint64_t>& rand2){
+	vector<Elgamal::CipherText> path_cost(tree.node_vec.size()); //path cost until every node
+	uint32_t i = 0, k = 0;
+	for(uint32_t j = 0; j < tree.node_vec.size(); j++){
+		const DecTree::Node* node = tree.node_vec[j];
+		//start calculating path costs
+		if(node->parent == NULL){ //if root
+			path_cost[node->right->id] = edgeCost1[i];
+			//right is 0, left is 1, could also be the other way around
+			path_cost[node->left->id] = edgeCost0[i];
+			i++;
+		}
+		else if(!(node->leaf)){ //decision nodes
+			edgeCost1[i].add(path_cost[node->id]);
+			edgeCost0[i].add(path_cost[node->id]);
+
+			path_cost[node->right->id] = edgeCost1[i];
+			path_cost[node->left->id] = edgeCost0[i];
+			i++;
+		}
+		else if(node->leaf){
+			pathCost[k] = path_cost[node->id];
+			classif[k] = path_cost[node->id];
+			k++;
 		}
 	}
-	return 0;
+	blindLeaves(pub, tree, pathCost, classif, rand1, rand2);
 }
 
-uint32_t testCompClient(const Elgamal::PublicKey& pub, const Elgamal::PrivateKey& prv, uint64_t client_input, tcp::iostream &conn){
-	vector<Elgamal::CipherText> enc_bits = encBitbyBitPrecomp(pub);
-	encBitbyBitOnline(pub, enc_bits, client_input);
-	send_ctxts(enc_bits, conn);
+/**
+ * Streaming version of calculatePathCosts (STREAM): folds the edge costs of every decision node into the
+ * path costs in node_vec order as soon as its reencrypted comparison bit arrives. Parents come before their
+ * children in node_vec and comparisons are numbered in the order of their first decision node, so every bit
+ * lets the walk proceed. The leaves are only collected, they are blinded and sent in one permuted batch
+ * after the last bit, so neither the order nor the timing of the frames depends on the path of the client.
+ */
+class PathFolder {
+  public:
+	PathFolder(const Elgamal::PublicKey& pub, const DecTree& tree, const vector<uint64_t>& server_bits)
+		: pathCost(tree.num_dec_nodes + 1), classif(tree.num_dec_nodes + 1), pub(pub), tree(tree), server_bits(server_bits),
+		path_cost(tree.node_vec.size()), i(0), j(0), k(0) {
+		bits.reserve(tree.num_cmps);
+	}
+	//the next comparison bit, in comparison order
+	void add(const Elgamal::CipherText& bit){
+		bits.push_back(bit);
+		fold();
+	}
+	bool done() const { return j == tree.node_vec.size(); }
+	//blinds the leaves of a walk that is done, see calculatePathCosts
+	void finish(vector<uint64_t>& rand1, vector<uint64_t>& rand2){
+		if(!done()){
+			throw cybozu::Exception("hhh:PathFolder:bits missing") << bits.size() << tree.num_cmps;
+		}
+		blindLeaves(pub, tree, pathCost, classif, rand1, rand2);
+	}
+
+	vector<Elgamal::CipherText> pathCost; //path costs on the leaves only, in node_vec order
+	vector<Elgamal::CipherText> classif;
+
+  private:
+	void fold(){
+		Elgamal::CipherText edgeCost0, edgeCost1;
+		for(; j < tree.node_vec.size(); j++){
+			const DecTree::Node* node = tree.node_vec[j];
+			if(node->leaf){
+				pathCost[k] = path_cost[node->id];
+				classif[k] = path_cost[node->id];
+				k++;
+				continue;
+			}
+			const uint32_t c = tree.cmp_index[i];
+			if(c >= bits.size()){
+				return;
+			}
+			edgeCost1 = xorWithConst(pub, bits[c], server_bits[c], rg);
+			edgeCost0 = edgeCost1;
+			edgeCost1.mul(-1);
+			pub.add(edgeCost1, 1);
+			if(node->parent != NULL){
+				edgeCost1.add(path_cost[node->id]);
+				edgeCost0.add(path_cost[node->id]);
+			}
+			//right is 0, left is 1, see calculatePathCosts
+			path_cost[node->right->id] = edgeCost1;
+			path_cost[node->left->id] = edgeCost0;
+			i++;
+		}
+	}
+
+	const Elgamal::PublicKey& pub;
+	const DecTree& tree;
+	const vector<uint64_t>& server_bits;
+	vector<Elgamal::CipherText> bits; //received so far
+	vector<Elgamal::CipherText> path_cost; //indexed by Node::id
+	uint32_t i, j, k; //next decision node, node and leaf
+};
+
+//EVALUATION PROTOCOL END
+
+//OFFLINE PRECOMPUTATION BEGIN
 
-	std::vector<Elgamal::CipherText> gt_result;
-	receive_ctxts(gt_result, bitlen, conn);
+//input-independent server material of the comparison phase for one session
+struct CompOfflineBundle {
+	vector<uint64_t> server_bits;
+	vector<Elgamal::CipherText> tmpsum; //encryptions of 0, one per comparison
+	vector< vector<Elgamal::CipherText> > padding; //encryptions of nonzero values, see CmpPlan
+};
 
-	uint32_t s = PvtCmpC(prv, gt_result);
-	cout << client_input << "  " << s << endl;
-	return s;
+//input-independent server material of the evaluation phase for one session
+struct EvalOfflineBundle {
+	vector<uint64_t> rand1;
+	vector<uint64_t> rand2;
+	vector<int> indeces; //permutation of the leaves
+};
+
+/**
+ * Appends the results of PvtCmpS on bits < 64 bits, 3 (xor count of the prefix) + x_j - y_j + s, for a random
+ * input x and threshold y. s is the one for which the comparison has no zero result, so the values are
+ * distributed as the nonzero results of a real comparison.
+ */
+void paddingValues(uint32_t bits, vector<int64_t>& values, AesCtrDrbg& rng){
+	const uint64_t mask = (1ULL << bits) - 1;
+	const uint64_t x = rng.get64() & mask, y = rng.get64() & mask;
+	const int64_t s = x < y ? -1 : x > y ? 1 : 1 - 2 * (int64_t)(rng.get32() & 1);
+	int64_t xors = 0;
+	for(uint32_t j = 0; j < bits; j++){ //most significant bit first
+		const int64_t xj = (x >> (bits - j - 1)) & 1, yj = (y >> (bits - j - 1)) & 1;
+		values.push_back(3 * xors + xj - yj + s);
+		xors += xj ^ yj;
+	}
 }
 
-uint32_t testCompServer(const Elgamal::PublicKey& pub, uint64_t server_input, tcp::iostream &conn){
-	uint32_t server_bit = std::rand() & 1;
-	cout << server_input << "  " << server_bit << endl;
+/**
+ * tmpsum is taken from store as far as it holds material, the rest is encrypted here.
+ * The padding of a comparison holds the results of a random comparison on its padding width, see paddingValues.
+ */
+void compOfflinePrecomp(const Elgamal::PublicKey& pub, uint32_t num_cmps, const vector<uint32_t>& padding,
+		OfflineStore<Elgamal>* store, CompOfflineBundle& bundle, AesCtrDrbg& rng){
+	bundle.server_bits.resize(num_cmps);
+	bundle.tmpsum.resize(num_cmps);
+	bundle.padding.resize(num_cmps);
+	vector<int64_t> values; //padding of all comparisons, encrypted in one batch
+	for(uint32_t i = 0; i < num_cmps; i++){
+		paddingValues(padding[i], values, rng);
+	}
+	vector<Elgamal::CipherText> enc_values(values.size());
+	pub.encBatch(enc_values.data(), values.data(), values.size(), rng);
+	for(uint32_t i = 0, k = 0; i < num_cmps; k += padding[i], i++){
+		bundle.padding[i].assign(enc_values.begin() + k, enc_values.begin() + k + padding[i]);
+	}
+	for(uint32_t i = 0; i < num_cmps; i++){
+		bundle.server_bits[i] = rng.get32() & 1;
+	}
+	const size_t stored = store ? store->take(bundle.tmpsum.data(), num_cmps) : 0;
+	pub.encOffBatch(bundle.tmpsum.data() + stored, num_cmps - stored, rng); //ciphertexts for m = 0
+}
 
-	std::vector<Elgamal::CipherText> ctxts;
-	receive_ctxts(ctxts, bitlen, conn);
-	assert(ctxts.size() == bitlen);
+void evalOfflinePrecomp(uint32_t num_dec_nodes, EvalOfflineBundle& bundle, AesCtrDrbg& rng){
+	bundle.rand1.resize(num_dec_nodes + 1);
+	bundle.rand2.resize(num_dec_nodes + 1);
+	bundle.indeces.resize(num_dec_nodes + 1);
+	for(uint32_t i = 0; i < num_dec_nodes + 1; ++i){
+		bundle.rand1[i] = rng.get64();
+		bundle.rand2[i] = rng.get64();
+		bundle.indeces[i] = i;
+	}
+	std::shuffle(bundle.indeces.begin(), bundle.indeces.end(), rng);
+}
 
-	Elgamal::CipherText tmpsum;
-	pub.enc(tmpsum, 0, rg); //ciphertext for m = 0
+//bundles kept ready per client public key and tree size, consumed by the next session of that client
+OfflineService<CompOfflineBundle> comp_offline_service(2, 16);
+OfflineService<EvalOfflineBundle> eval_offline_service(2, 16);
+
+/*
+	on-disk stores of encryptions of 0 survive restarts and can be filled ahead of time with "hhh 2 <queries>"
+	stores are only used if store_dir exists, the client then also keeps its key pair there
+*/
+const string store_dir = "../../../offline_store";
+const uint32_t store_role_server = 0;
+const uint32_t store_role_client = 1;
+const size_t store_maps = 16; //server stores kept mapped, stores no session or refill holds are unmapped for a new one
+
+//makes store_dir owner-only, false if it is not a directory of this user
+bool prepareStoreDir(){
+	return prepare_private_dir(store_dir);
+}
 
-	vector<Elgamal::CipherText> gt_result =  PvtCmpS(pub, tmpsum, ctxts, server_input, server_bit);
+//encryptions of 0 one query takes from a store, input_bits is the sum of the attribute bit widths
+uint32_t storePerQuery(uint32_t role, uint32_t input_bits, uint32_t num_cmps){
+	if(role == store_role_server){
+		return num_cmps; //tmpsum
+	}
+	return 2 * input_bits + num_cmps; //bit pool fill and reencrypted comparison bits
+}
 
-	send_ctxts(gt_result, conn);
-	return server_bit;
+/**
+ * Maps the store of role for pub and the tree shape. A missing store is created empty, so that
+ * refillOfflineStores knows which key and shape to precompute for.
+ */
+bool openOfflineStore(OfflineStore<Elgamal>& store, uint32_t role, const Elgamal::PublicKey& pub, uint32_t num_attributes, uint32_t num_cmps, uint32_t per_query){
+	if(!prepareStoreDir()){
+		return false;
+	}
+	const string pub_str = pub.getStr();
+	const string file = OfflineStore<Elgamal>::path(store_dir, role, pub_str, num_attributes, num_cmps);
+	if(store.open(file, role, pub_str, num_attributes, num_cmps)){
+		return true;
+	}
+	return OfflineStore<Elgamal>::write(file, role, pub_str, num_attributes, num_cmps,
+			per_query, vector<Elgamal::CipherText>())
+		&& store.open(file, role, pub_str, num_attributes, num_cmps);
 }
 
-//COMPARISON PROTOCOL END
+/**
+ * Server stores are shared by all sessions and the offline service thread of a client,
+ * so that the same file is never mapped twice. Returns NULL if stores are not used.
+ * Once store_maps stores are mapped, a new one first drops the stores held by no one else.
+ */
+std::shared_ptr< OfflineStore<Elgamal> > serverOfflineStore(const Elgamal::PublicKey& pub, uint32_t num_attributes, uint32_t num_cmps){
+	static std::map<string, std::shared_ptr< OfflineStore<Elgamal> > > stores;
+	static std::mutex mtx;
+	const string key = pub.getStr() + "/" + std::to_string(num_attributes) + "/" + std::to_string(num_cmps);
+	std::lock_guard<std::mutex> lock(mtx);
+	if(stores.size() >= store_maps && stores.find(key) == stores.end()){
+		for(std::map<string, std::shared_ptr< OfflineStore<Elgamal> > >::iterator it = stores.begin(); it != stores.end();){
+			if(!it->second || it->second.use_count() == 1){
+				it = stores.erase(it);
+			}
+			else{
+				++it;
+			}
+		}
+	}
+	std::shared_ptr< OfflineStore<Elgamal> >& store = stores[key];
+	if(!store){
+		store = std::make_shared< OfflineStore<Elgamal> >();
+		if(!openOfflineStore(*store, store_role_server, pub, num_attributes, num_cmps, storePerQuery(store_role_server, 0, num_cmps))){
+			store.reset();
+		}
+	}
+	return store;
+}
 
-//EVALUATION PROTOCOL BEGIN
+//reads a key file written completely, i.e. up to its final newline
+bool readClientKey(Elgamal::PrivateKey& prv, const string& file){
+	ifstream in(file.c_str());
+	std::stringstream buf;
+	buf << in.rdbuf();
+	const string str = buf.str();
+	return !str.empty() && str[str.size() - 1] == '\n' && (buf >> prv);
+}
 
-void calculatePathCosts(const Elgamal::PublicKey& pub, DecTree& tree, vector<Elgamal::CipherText>& pathCost,
-		vector<Elgamal::CipherText>& classif, vector<Elgamal::CipherText>& edgeCost0,
-		vector<Elgamal::CipherText>& edgeCost1, vector<uint64_t>& rand1, vector<uint64_t>& rand2){
-	Elgamal::CipherText tmp;
-	uint32_t i = 0, k = 0;
-	for(uint32_t j = 0; j < tree.node_vec.size(); j++){
-		//start calculating path costs
-		if(tree.node_vec[j]->parent == NULL){ //if root
-			tree.node_vec[j]->right->path_cost = edgeCost1[i];
-			//right is 0, left is 1, could also be the other way around
-			tree.node_vec[j]->left->path_cost = edgeCost0[i];
-			i++;
+/**
+ * Client key pair of the stores, generated on first use, one per curve. The file is created
+ * exclusively and owner-only before the key is written, so the private key is never readable by
+ * others and clients starting together agree on one key: the losers read the winner's file.
+ */
+void loadClientKey(Elgamal::PrivateKey& prv, const Ec& P, size_t bitSize){
+	const string file = HHH_CURVE == 0 ? store_dir + "/client.key" : store_dir + "/client_" + HHHGroup::name() + ".key";
+	if(readClientKey(prv, file)){
+		return;
+	}
+	const int fd = open(file.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0600);
+	if(fd < 0){
+		if(errno != EEXIST){
+			throw cybozu::Exception("hhh:loadClientKey:can't create") << file << errno;
 		}
-		else if(!(tree.node_vec[j]->leaf)){ //decision nodes
-			edgeCost1[i].add(tree.node_vec[j]->path_cost);
-			edgeCost0[i].add(tree.node_vec[j]->path_cost);
-			
-			tree.node_vec[j]->right->path_cost = edgeCost1[i];
-			tree.node_vec[j]->left->path_cost = edgeCost0[i];
-			i++;
+		for(int i = 0; i < 50; i++){ //another client is writing it
+			if(readClientKey(prv, file)){
+				return;
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		}
+		throw cybozu::Exception("hhh:loadClientKey:bad key file") << file;
+	}
+	prv.init(P, bitSize, rg);
+	std::ostringstream out;
+	out << prv << '\n';
+	const string str = out.str();
+	size_t done = 0;
+	while(done < str.size()){
+		const ssize_t n = write(fd, str.data() + done, str.size() - done);
+		if(n < 0 && errno == EINTR){
+			continue;
 		}
-		else if(tree.node_vec[j]->leaf){
-			tmp = tree.node_vec[j]->path_cost;
-			tree.node_vec[j]->path_cost.mul(rand1[k]);
-			pathCost[k] = tree.node_vec[j]->path_cost;
+		if(n <= 0){
+			close(fd);
+			throw cybozu::Exception("hhh:loadClientKey:can't write") << file << errno;
+		}
+		done += n;
+	}
+	fsync(fd);
+	close(fd);
+}
 
-			tmp.mul(rand2[k]);
-			pub.add(tmp, tree.node_vec[j]->classification);
-			classif[k] = tmp;
+/**
+ * Tops up every store in store_dir to the material of queries queries. The remaining entries are taken
+ * from the old file, so a party still mapping it cannot use them, and written to the new file together
+ * with fresh encryptions of 0, which then atomically replaces the old one. The old file stays locked
+ * until it is replaced, so no party in another process takes from it meanwhile.
+ */
+void refillOfflineStores(uint32_t queries){
+	DIR* dir = prepareStoreDir() ? opendir(store_dir.c_str()) : NULL;
+	if(dir == NULL){
+		cout << "no offline store directory " << store_dir << endl;
+		return;
+	}
+	vector<string> files;
+	for(struct dirent* entry = readdir(dir); entry != NULL; entry = readdir(dir)){
+		const string name = entry->d_name;
+		if(name.compare(0, 4, "hhh_") == 0 && name.size() > 6 && name.compare(name.size() - 6, 6, ".store") == 0){
+			files.push_back(store_dir + "/" + name);
+		}
+	}
+	closedir(dir);
 
-			k++;
+	timeval tbegin, tend;
+	for(uint32_t f = 0; f < files.size(); f++){
+		gettimeofday(&tbegin, NULL);
+		//locked from the take to the rename, a concurrent refill waits and then reopens the new file
+		OfflineStore<Elgamal> store;
+		bool locked = false;
+		while(store.open(files[f]) && store.lock()){
+			if(store.is_current(files[f])){
+				locked = true;
+				break;
+			}
+			store.close();
+		}
+		if(!locked){
+			cout << files[f] << ": skipped, not a store of this build" << endl;
+			continue;
+		}
+		const StoreHeader header = store.header();
+		const string pub_str = store.pub_str();
+		//the name must be the one of the key and shape inside, else queries would never open the refilled file
+		if(header.key_hash != hash_str(pub_str)
+			|| files[f] != OfflineStore<Elgamal>::path(store_dir, header.role, pub_str, header.num_attributes, header.num_cmps)){
+			cout << files[f] << ": skipped, header does not match the file name" << endl;
+			continue;
 		}
+		Elgamal::PublicKey pub;
+		try{
+			pub.setStr(pub_str);
+		}
+		catch(std::exception& e){
+			cout << files[f] << ": skipped, key of another curve" << endl;
+			continue;
+		}
+
+		vector<Elgamal::CipherText> entries(store.available());
+		entries.resize(store.take(entries.data(), entries.size()));
+		const size_t kept = entries.size();
+		const size_t target = (size_t)header.per_query * queries;
+		if(kept < target){
+			entries.resize(target);
+			pub.encOffBatch(&entries[kept], target - kept, rg);
+		}
+		const bool written = OfflineStore<Elgamal>::write(files[f], header.role, pub_str, header.num_attributes, header.num_cmps, header.per_query, entries);
+		store.close();
+		if(!written){
+			cout << files[f] << ": write failed" << endl;
+			continue;
+		}
+		gettimeofday(&tend, NULL);
+		cout << files[f] << ": " << kept << " kept, " << entries.size() - kept << " precomputed in "
+			<< ((tend.tv_sec-tbegin.tv_sec)*1000000 + tend.tv_usec - tbegin.tv_usec)/1000 << "ms" << endl;
 	}
 }
 
-//EVALUATION PROTOCOL END
+//OFFLINE PRECOMPUTATION END
 
 
 //CLIENTSERVER BEGIN
 
-void play_server(tcp::iostream &conn)
-{
-	const char* filename[7] = {
-			"../../../UCI_dectrees/wine",
-			"../../../UCI_dectrees/iris",
-			"../../../UCI_dectrees/breast",
-			"../../../UCI_dectrees/digits",
-			"../../../UCI_dectrees/diabetes",
-			"../../../UCI_dectrees/linnerud",
-			"../../../UCI_dectrees/boston"
-	};
-	uint32_t i = DT, k = 0;
+//decision trees selected by DT
+const char* dt_files[7] = {
+		"../../../UCI_dectrees/wine",
+		"../../../UCI_dectrees/iris",
+		"../../../UCI_dectrees/breast",
+		"../../../UCI_dectrees/digits",
+		"../../../UCI_dectrees/diabetes",
+		"../../../UCI_dectrees/linnerud",
+		"../../../UCI_dectrees/boston"
+};
+
+//model name of a tree file, i.e. the file name without directory and version
+string modelName(const string& file){
+	string name;
+	uint64_t version;
+	parseModelFileName(file.substr(file.rfind('/') + 1), name, version);
+	return name;
+}
+
+string client_model; //model the client queries, 2nd command line argument of the client, by default the tree selected by DT
+uint32_t client_queries = 1; //feature vectors the client classifies in one session, 3rd command line argument of the client
+uint32_t client_changes = 0; //attributes drawn anew from one feature vector to the next, 4th command line argument of the client, 0 for all
+
+/*
+	decision tree prepared for serving, loaded once and then only read by all sessions on it
+*/
+struct ServerModel {
 	DecTree tree;
-	tree.read_from_file(filename[i]);
+	CmpPlan cmp_plan;
+	int64_t label_min; //range of the leaf labels, sizes the decryption table of the client
+	int64_t label_max;
+};
+
+//returns false if file holds no decision tree, throws if a leaf label is outside [-max_label, max_label]
+bool loadServerModel(ServerModel& model, const string& file){
+	DecTree& tree = model.tree;
+	tree.read_from_file(file);
+	if(tree.num_dec_nodes == 0){
+		return false;
+	}
 	if(PROT == 2){
 		tree.depthPad(); //for benchmarking inefficient protocol HHG
 	}
+	tree.compile(PROT == 0); //HH(G) and (GG)H exchange comparison shares per decision node
+	buildCmpPlan(tree, model.cmp_plan);
+	model.label_min = max_label;
+	model.label_max = -max_label;
+	for(uint32_t i = 0; i < tree.node_vec.size(); i++){
+		if(tree.node_vec[i]->leaf){
+			const int64_t label = (int64_t)tree.node_vec[i]->classification;
+			if(label < -max_label || label > max_label){
+				throw cybozu::Exception("hhh:loadServerModel:label out of range") << file << label;
+			}
+			model.label_min = std::min(model.label_min, label);
+			model.label_max = std::max(model.label_max, label);
+		}
+	}
+	return true;
+}
+
+/*
+	comparison workers of the server and their generators, shared by all sessions
+*/
+struct ServerContext {
+	WorkerPool pool;
+	std::unique_ptr<AesCtrDrbg[]> rngs; //one generator per worker
+
+	explicit ServerContext(uint32_t num_threads)
+	  : pool(num_threads)
+	  , rngs(new AesCtrDrbg[pool.size()])
+	{}
+};
+
+//microseconds from tbegin to tend
+uint64_t elapsedUs(const timeval& tbegin, const timeval& tend){
+	return (tend.tv_sec-tbegin.tv_sec)*1000000 + tend.tv_usec - tbegin.tv_usec;
+}
+
+/**
+ * Inputs of one query: the client lists the attributes whose value changed since the previous query of the
+ * session (all of them for the first query), followed by one frame of encrypted bits per listed attribute.
+ * ctxts keeps the bits of the other attributes, fresh flags the listed ones. Returns the number listed.
+ */
+uint32_t receiveInputs(vector< vector<Elgamal::CipherText> >& ctxts, vector<bool>& fresh, const DecTree& tree, const Channel &ch){
+	tcp::iostream &conn = ch.conn;
+	ctxts.resize(tree.num_attributes);
+	fresh.assign(tree.num_attributes, false);
+	uint32_t num_changed;
+	conn >> num_changed;
+	if(!conn || num_changed > tree.num_attributes){
+		throw cybozu::Exception("hhh:receiveInputs:bad number of attributes") << num_changed;
+	}
+	vector<uint32_t> changed(num_changed);
+	for(uint32_t i = 0; i < num_changed; i++){
+		conn >> changed[i];
+		if(!conn || changed[i] >= tree.num_attributes || fresh[changed[i]]){
+			throw cybozu::Exception("hhh:receiveInputs:bad attribute") << changed[i];
+		}
+		fresh[changed[i]] = true;
+	}
+	for(uint32_t i = 0; i < num_changed; i++){
+		receive_ctxts(ctxts[changed[i]], tree.attribute_bits[changed[i]], ch);
+	}
+	for(uint32_t a = 0; a < tree.num_attributes; a++){
+		if(ctxts[a].size() != tree.attribute_bits[a]){ //the first query of a session sends every attribute
+			throw cybozu::Exception("hhh:receiveInputs:missing attribute") << a;
+		}
+	}
+	return num_changed;
+}
+
+//blinded path costs and classifications of the leaves, sent in one batch permuted by eval_offline.indeces
+void sendLeaves(const vector<Elgamal::CipherText>& pathCost, const vector<Elgamal::CipherText>& classif,
+		const EvalOfflineBundle& eval_offline, const Channel &ch){
+	vector<Elgamal::CipherText> pathCost_shuffled(pathCost.size());
+	vector<Elgamal::CipherText> classif_shuffled(classif.size());
+	for(uint32_t i = 0; i < pathCost.size(); ++i){
+		pathCost_shuffled[i] = pathCost[eval_offline.indeces[i]];
+		classif_shuffled[i] = classif[eval_offline.indeces[i]];
+	}
+	send_ctxts(pathCost_shuffled, ch); //the client pairs them by position, whatever the order
+	send_ctxts(classif_shuffled, ch);
+}
+
+/**
+ * Evaluation phase of one query with the comparison bits reencrypted by the client: path costs of all
+ * leaves, blinded with the material in eval_offline, and the blinded classifications, see sendLeaves
+ */
+void serverEvalOnline(const Elgamal::PublicKey& pub, const DecTree& tree, const vector<uint64_t>& server_bits,
+		EvalOfflineBundle& eval_offline, const vector<Elgamal::CipherText>& reenc, const Channel &ch){
+	vector<Elgamal::CipherText> edgeCost1(tree.num_dec_nodes);
+	vector<Elgamal::CipherText> edgeCost0(tree.num_dec_nodes);
+	for(uint32_t i = 0; i < tree.num_dec_nodes; i++){ //fan out every comparison to the nodes using it
+		const uint32_t c = tree.cmp_index[i];
+		edgeCost1[i] = xorWithConst(pub, reenc[c], server_bits[c], rg);
+		edgeCost0[i] = edgeCost1[i];
+		edgeCost1[i].mul(-1);
+		pub.add(edgeCost1[i], 1);
+	}
+
+	vector<Elgamal::CipherText> pathCost(tree.num_dec_nodes + 1); //path costs on the leaves only!
+	vector<Elgamal::CipherText> classif(tree.num_dec_nodes + 1); //classification on the leaves only!
+
+	calculatePathCosts(pub, tree, pathCost, classif, edgeCost0, edgeCost1, eval_offline.rand1, eval_offline.rand2);
+	sendLeaves(pathCost, classif, eval_offline, ch);
+}
+
+/**
+ * Server side of the queries of one session on model. Sessions on other connections may run concurrently,
+ * they share model and ctx.
+ * The client announces the number of queries after its key. Queries are pipelined: the inputs of query q + 1
+ * are received after the comparisons of query q are computed and before their results are sent, so the client
+ * encrypts query q + 1 and decrypts the leaves of query q - 1 while the server compares on query q.
+ * Every step has one party sending and the other receiving, large messages cannot block both of them.
+ * The encrypted attributes and their trie prefix sums are kept from one query to the next, the client
+ * sends only the attributes that changed, see receiveInputs.
+ */
+void serveSession(tcp::iostream &conn, const ServerModel& model, ServerContext& ctx)
+{
+	const DecTree& tree = model.tree;
+	const CmpPlan& cmp_plan = model.cmp_plan;
 
 	conn << tree.num_attributes  << '\n';
 	conn << tree.num_dec_nodes  << '\n';
+	conn << tree.num_cmps  << '\n';
+	for(uint32_t i = 0; i < tree.num_attributes; i++){
+		conn << tree.attribute_bits[i] << ' ' << tree.attribute_offsets[i] << '\n';
+	}
+	conn << model.label_min << '\n';
+	conn << model.label_max << '\n';
+	conn << COMPRESS << '\n'; //offers compressed frames
+	conn << HHHGroup::name() << '\n'; //both parties must be built for the same HHH_CURVE
 
 	timeval tbegin, tend;
 
-	Elgamal::PublicKey pub;
+	int compress_accepted;
+	conn >> compress_accepted;
+	const Channel ch = {conn, compress_accepted != 0};
+
+	//the producers of the offline services share the key of the session and may outlive it
+	const std::shared_ptr<Elgamal::PublicKey> session_pub = std::make_shared<Elgamal::PublicKey>();
+	Elgamal::PublicKey& pub = *session_pub;
 	conn >> pub; //reads public key
+	uint32_t num_queries;
+	conn >> num_queries;
+	if(!conn || num_queries == 0 || (num_queries > 1 && PROT != 0)){ //HH(G) and (GG)H exchange shares of one query via files
+		throw cybozu::Exception("hhh:serveSession:bad number of queries") << num_queries;
+	}
+	cout << "Window tables: " << pub.getWindowMemoryByteSize() / 1024 << "KB";
+	if(window_cache){
+		cout << " (cache: " << window_cache->keys() << " keys, " << window_cache->memoryByteSize() / 1024 << "KB mapped, "
+			<< window_cache->hits() << " hits, " << window_cache->builds() << " builds)";
+	}
+	cout << endl;
 
-	//COMPARISON OFFLINE
-	gettimeofday(&tbegin, NULL);
-	vector<uint64_t> server_bits(tree.num_dec_nodes);
-	vector<Elgamal::CipherText> tmpsum(tree.num_dec_nodes);
-	if(PROT == 0 || PROT == 1){	
-		for (uint32_t i = 0; i < tree.num_dec_nodes; i++) {
-			server_bits[i] = std::rand() & 1;
+	//offline material depends on the client key and the tree size only
+	string offline_key = pub.getStr() + "/" + std::to_string(tree.num_dec_nodes) + "/" + std::to_string(tree.num_cmps);
+	for(uint32_t c = 0; c < tree.num_cmps; c++){
+		offline_key += "/" + std::to_string(cmp_plan.padding[c]);
+	}
+	//the services refill the key while the session lasts, and afterwards only if the client comes back with it
+	OfflineService<CompOfflineBundle>::Session comp_offline_session(comp_offline_service, offline_key);
+	OfflineService<EvalOfflineBundle>::Session eval_offline_session(eval_offline_service, offline_key);
+	const std::shared_ptr<const Elgamal::PublicKey> offline_pub = session_pub;
+	std::shared_ptr< OfflineStore<Elgamal> > offline_store = serverOfflineStore(pub, tree.num_attributes, tree.num_cmps);
+	const uint32_t num_dec_nodes = tree.num_dec_nodes;
+	const uint32_t num_cmps = tree.num_cmps;
+	const vector<uint32_t> padding = cmp_plan.padding;
+
+	//the offline material of every query is taken when the query starts, the services refill meanwhile
+	uint64_t comp_offline_us = 0, eval_offline_us = 0, comp_online_us = 0, eval_online_us = 0;
+	const bool lookahead = (PROT == 0 && !STREAM) || PROT == 1; //streamed queries run one after the other
+	vector< vector<Elgamal::CipherText> > ctxts, next_ctxts, prefixes;
+	vector<bool> fresh, next_fresh;
+	uint64_t attributes_received = 0;
+	timeval tbegin_online;
+	gettimeofday(&tbegin_online, NULL);
+	for(uint32_t q = 0; q < num_queries; q++){
+		//COMPARISON OFFLINE
+		gettimeofday(&tbegin, NULL);
+		CompOfflineBundle comp_offline;
+		comp_offline.server_bits.resize(tree.num_cmps);
+		if(PROT == 0 || PROT == 1){
+			comp_offline_service.acquire(offline_key, [offline_pub, offline_store, num_cmps, padding](CompOfflineBundle& bundle, AesCtrDrbg& rng){
+				compOfflinePrecomp(*offline_pub, num_cmps, padding, offline_store.get(), bundle, rng);
+			}, comp_offline);
+			gettimeofday(&tend, NULL);
+			comp_offline_us += elapsedUs(tbegin, tend);
 		}
-		for(uint32_t i = 0; i < tree.num_dec_nodes; i++){
-			pub.enc(tmpsum[i], 0, rg); //ciphertext for m = 0
+		vector<uint64_t>& server_bits = comp_offline.server_bits;
+
+		//EVAL OFFLINE
+		gettimeofday(&tbegin, NULL);
+		EvalOfflineBundle eval_offline;
+		if(PROT == 0 || PROT == 2){
+			eval_offline_service.acquire(offline_key, [num_dec_nodes](EvalOfflineBundle& bundle, AesCtrDrbg& rng){
+				evalOfflinePrecomp(num_dec_nodes, bundle, rng);
+			}, eval_offline);
+			gettimeofday(&tend, NULL);
+			eval_offline_us += elapsedUs(tbegin, tend);
 		}
-		gettimeofday(&tend, NULL);
-		cout << "Comp Offline: " << ((tend.tv_sec-tbegin.tv_sec)*1000000 + tend.tv_usec - tbegin.tv_usec)/1000 << "ms" << endl;
-	}
 
-	//EVAL OFFLINE
-	gettimeofday(&tbegin, NULL);
-	vector<uint64_t> rand1(tree.num_dec_nodes + 1);
-	vector<uint64_t> rand2(tree.num_dec_nodes + 1);
-	vector<int> indeces(tree.num_dec_nodes + 1);
-	if(PROT == 0 || PROT == 2){
-		for(uint32_t i = 0; i < tree.num_dec_nodes + 1; ++i){
-			rand1[i] = rg.get64();
-			rand2[i] = rg.get64();
+		//COMPARISON ONLINE
+		gettimeofday(&tbegin, NULL);
+		vector< vector<Elgamal::CipherText> > gt_results(tree.num_cmps);
+		std::unique_ptr<PathFolder> folder; //STREAM: edge costs folded as the reencrypted bits arrive
+		if(PROT == 0 || PROT == 1){
+			if(q == 0 || !lookahead){
+				attributes_received += receiveInputs(ctxts, fresh, tree, ch);
+			}
+
+			if(PROT == 0 && STREAM){
+				folder.reset(new PathFolder(pub, tree, server_bits));
+				PathFolder* f = folder.get();
+				PvtCmpSParallel(pub, comp_offline.tmpsum, comp_offline.padding, ctxts, prefixes, fresh, tree, cmp_plan, server_bits, gt_results,
+					ctx.pool, ctx.rngs.get(), &ch, [f](const Elgamal::CipherText& bit){ f->add(bit); });
+			}
+			else if(q + 1 < num_queries){ //results are held back until the inputs of the next query are in
+				PvtCmpSParallel(pub, comp_offline.tmpsum, comp_offline.padding, ctxts, prefixes, fresh, tree, cmp_plan, server_bits, gt_results,
+					ctx.pool, ctx.rngs.get(), NULL);
+				next_ctxts = ctxts;
+				attributes_received += receiveInputs(next_ctxts, next_fresh, tree, ch);
+				for(uint32_t c = 0; c < tree.num_cmps; c++){
+					send_ctxts(gt_results[c], ch);
+				}
+				ctxts.swap(next_ctxts);
+				fresh.swap(next_fresh);
+			}
+			else{
+				PvtCmpSParallel(pub, comp_offline.tmpsum, comp_offline.padding, ctxts, prefixes, fresh, tree, cmp_plan, server_bits, gt_results,
+					ctx.pool, ctx.rngs.get(), &ch);
+			}
+			gettimeofday(&tend, NULL);
+			comp_online_us += elapsedUs(tbegin, tend);
+		}
+		if(PROT == 1){
+			ofstream output_shares;
+			output_shares.open("../../../output/compH_shares_server.txt");
+			for(uint32_t i = 0; i < tree.num_cmps; i++){
+				output_shares << server_bits[i] << endl;
+			}
+			output_shares.close();
 		}
-		for(uint32_t i = 0; i < tree.num_dec_nodes + 1; ++i){
-			indeces.push_back(i);
+		if(PROT == 2){
+			ifstream output_shares;
+			char c;
+			output_shares.open("../../../output/compG_shares_server.txt");
+			uint32_t j = 0;
+			while(output_shares >> server_bits[j]){
+				j++;
+			}
+			output_shares.close();
 		}
-		std::random_shuffle(indeces.begin(), indeces.end());
 
-		gettimeofday(&tend, NULL);
-		cout << "Eval Offline: " << ((tend.tv_sec-tbegin.tv_sec)*1000000 + tend.tv_usec - tbegin.tv_usec)/1000 << "ms" << endl;
+		//EVAL ONLINE
+		gettimeofday(&tbegin, NULL);
+		if(PROT == 0 || PROT == 2){
+			if(PROT == 0 && STREAM){ //the path costs are complete with the last bit
+				folder->finish(eval_offline.rand1, eval_offline.rand2);
+				sendLeaves(folder->pathCost, folder->classif, eval_offline, ch);
+			}
+			else{
+				vector<Elgamal::CipherText> reenc; //comparison bits reencrypted by the client
+				receive_ctxts(reenc, tree.num_cmps, ch); //all reencrypted comparison bits in one message
+				serverEvalOnline(pub, tree, server_bits, eval_offline, reenc, ch);
+			}
+			gettimeofday(&tend, NULL);
+			eval_online_us += elapsedUs(tbegin, tend);
+		}
 	}
+	timeval tend_online;
+	gettimeofday(&tend_online, NULL);
 
-	//COMPARISON ONLINE
-	gettimeofday(&tbegin, NULL);
-	vector< vector<Elgamal::CipherText> > gt_results(tree.num_dec_nodes);
 	if(PROT == 0 || PROT == 1){
-		std::vector< std::vector<Elgamal::CipherText> > ctxts(tree.num_attributes);
-		for (uint32_t i = 0; i < tree.num_attributes; i++) {
-			receive_ctxts(ctxts[i], bitlen, conn);
-		}
-
-		for(uint32_t i = 0; i < tree.num_dec_nodes; i++){
-			gt_results[i] = PvtCmpS(pub, tmpsum[i], ctxts[tree.decnode_vec[i]->attribute_index],
-				tree.decnode_vec[i]->threshold, server_bits[i]);
-			//cout << tree.decnode_vec[i]->threshold << " " << server_bits[i] << " " << tree.decnode_vec[i]->attribute_index << endl; CHECKED CORRECT
-			send_ctxts(gt_results[i], conn);
-		}
-		gettimeofday(&tend, NULL);
-		cout << "Comp Online: " << ((tend.tv_sec-tbegin.tv_sec)*1000000 + tend.tv_usec - tbegin.tv_usec)/1000 << "ms" << endl;
+		cout << "Comp Offline: " << comp_offline_us/1000 << "ms"
+			<< " (pool: " << comp_offline_service.hits() << " hits, " << comp_offline_service.misses() << " misses)" << endl;
 	}
-	if(PROT == 1){
-		ofstream output_shares;
-		output_shares.open("../../../output/compH_shares_server.txt");
-		for(uint32_t i = 0; i < tree.num_dec_nodes; i++){
-			output_shares << server_bits[i] << endl;
-		}
-		output_shares.close();
+	if(PROT == 0 || PROT == 2){
+		cout << "Eval Offline: " << eval_offline_us/1000 << "ms"
+			<< " (pool: " << eval_offline_service.hits() << " hits, " << eval_offline_service.misses() << " misses)" << endl;
 	}
-	if(PROT == 2){
-		ifstream output_shares;
-		char c;
-		output_shares.open("../../../output/compG_shares_server.txt");
-		uint32_t j = 0;
-		while(output_shares >> server_bits[j]){
-			j++;
-		}
-		output_shares.close();
+	if(PROT == 0 || PROT == 1){
+		cout << "Comp Online" << (STREAM ? " (streamed, with the path costs)" : "") << ": " << comp_online_us/1000 << "ms" << endl;
 	}
-
-	//EVAL ONLINE
-	gettimeofday(&tbegin, NULL);
-	vector< vector<Elgamal::CipherText> > reenc(tree.num_dec_nodes);
-	vector<Elgamal::CipherText> edgeCost1(tree.num_dec_nodes);
-	vector<Elgamal::CipherText> edgeCost0(tree.num_dec_nodes);
 	if(PROT == 0 || PROT == 2){
-		for(uint32_t i = 0; i < tree.num_dec_nodes; i++){
-			receive_ctxts(reenc[i], 1, conn);
-			edgeCost1[i] = xorWithConst(pub, reenc[i][0], server_bits[i]);
-			edgeCost0[i] = edgeCost1[i];
-			edgeCost1[i].mul(-1);
-			pub.add(edgeCost1[i], 1);
+		cout << "Eval Online: " << eval_online_us/1000 << "ms" << endl;
+	}
+	if(num_queries > 1){
+		const uint64_t total_us = elapsedUs(tbegin_online, tend_online);
+		cout << num_queries << " queries: " << total_us/1000 << "ms, " << total_us/num_queries/1000.0 << "ms per query, "
+			<< num_queries * 1000000.0 / total_us << " queries/s" << endl;
+		if(PROT == 0 || PROT == 1){
+			cout << "Attributes received: " << attributes_received << " of " << (uint64_t)num_queries * tree.num_attributes << endl;
 		}
+	}
+}
 
-		vector<Elgamal::CipherText> pathCost(tree.num_dec_nodes + 1); //path costs on the leaves only!
-		vector<Elgamal::CipherText> classif(tree.num_dec_nodes + 1); //classification on the leaves only!
+/*
+	a session starts with the client naming the model it queries, the server answers with the version
+	of the model it serves or -1 if it does not serve it
+*/
+string receiveModelRequest(tcp::iostream &conn){
+	string name;
+	conn >> name;
+	return name;
+}
 
-		calculatePathCosts(pub, tree, pathCost, classif, edgeCost0, edgeCost1, rand1, rand2);
+void sendModelVersion(tcp::iostream &conn, int64_t version){
+	conn << version << '\n';
+	conn.flush();
+}
 
-		vector<Elgamal::CipherText> pathCost_shuffled(tree.num_dec_nodes + 1);
-		vector<Elgamal::CipherText> classif_shuffled(tree.num_dec_nodes + 1);
-		for(uint32_t i = 0; i < tree.num_dec_nodes + 1; ++i){
-			pathCost_shuffled[i] = pathCost[indeces[i]];
-			classif_shuffled[i] = classif[indeces[i]];
-		}
-		send_ctxts(pathCost, conn);
-		send_ctxts(classif, conn);
+//one query on the tree selected by DT
+void play_server(tcp::iostream &conn)
+{
+	ServerModel model;
+	if(!loadServerModel(model, dt_files[DT])){
+		throw cybozu::Exception("hhh:play_server:no decision tree") << dt_files[DT];
+	}
+	const string name = receiveModelRequest(conn);
+	if(name != modelName(dt_files[DT])){
+		sendModelVersion(conn, -1);
+		throw cybozu::Exception("hhh:play_server:unknown model") << name;
+	}
+	sendModelVersion(conn, 0);
+	ServerContext ctx(cmp_threads);
+	serveSession(conn, model, ctx);
+}
 
-		gettimeofday(&tend, NULL);
-		cout << "Eval Online: " << ((tend.tv_sec-tbegin.tv_sec)*1000000 + tend.tv_usec - tbegin.tv_usec)/1000 << "ms" << endl;
+/**
+ * Long-running server: serves the models in model_dir to every client that connects, up to sessions
+ * of them concurrently, the others wait in the queue of the session pool. A session runs on the version
+ * of its model that was latest when it started, new versions are loaded in the background.
+ * A failing session is logged and does not affect the others.
+ */
+void runServerDaemon(uint32_t sessions){
+	ModelRegistry<ServerModel> registry(model_dir, loadServerModel, model_poll_seconds);
+	registry.scan();
+	const vector<ModelRegistry<ServerModel>::Entry> models = registry.models();
+	if(models.empty()){
+		throw cybozu::Exception("hhh:runServerDaemon:no models") << model_dir;
+	}
+	ServerContext ctx(cmp_threads);
+	WorkerPool session_pool(sessions);
+	cout << "serving";
+	for(size_t i = 0; i < models.size(); i++){
+		cout << " " << models[i].name << " v" << models[i].version;
+	}
+	cout << " from " << model_dir << " on port " << PORT
+		<< " with " << session_pool.size() << " sessions and " << ctx.pool.size() << " comparison workers" << endl;
+
+	boost::asio::io_service ios;
+	tcp::acceptor acceptor(ios, tcp::endpoint(tcp::v4(), PORT));
+	for(uint64_t id = 0; ; id++){
+		std::shared_ptr<tcp::iostream> conn = std::make_shared<tcp::iostream>();
+		boost::system::error_code err;
+		acceptor.accept(conn->socket(), err);
+		if(err){
+			cout << "accept failed: " << err.message() << endl;
+			continue;
+		}
+		session_pool.submit([conn, id, &registry, &ctx](uint32_t){
+			timeval tbegin, tend;
+			gettimeofday(&tbegin, NULL);
+			try{
+				const string name = receiveModelRequest(*conn);
+				uint64_t version;
+				std::shared_ptr<const ServerModel> model = registry.get(name, &version); //kept until the session ends
+				if(!model){
+					sendModelVersion(*conn, -1);
+					throw cybozu::Exception("hhh:runServerDaemon:unknown model") << name;
+				}
+				sendModelVersion(*conn, version);
+				serveSession(*conn, *model, ctx);
+				gettimeofday(&tend, NULL);
+				cout << "session " << id << " on " << name << " v" << version << ": "
+					<< ((tend.tv_sec-tbegin.tv_sec)*1000000 + tend.tv_usec - tbegin.tv_usec)/1000 << "ms" << endl;
+			}
+			catch(std::exception& e){
+				cout << "session " << id << " failed: " << e.what() << endl;
+			}
+		});
 	}
 }
 
 void play_client(tcp::iostream &conn)
 {
+	conn << client_model << '\n';
+	int64_t model_version;
+	conn >> model_version;
+	if(model_version < 0){
+		throw cybozu::Exception("hhh:play_client:server does not serve model") << client_model;
+	}
+	cout << "model " << client_model << " v" << model_version << endl;
 
 	uint32_t num_attributes;
 	uint32_t num_dec_nodes;
+	uint32_t num_cmps; //distinct comparisons, each one is run once for all decision nodes that use it
 	conn >> num_attributes;
 	conn >> num_dec_nodes;
-
-	vector<uint64_t> client_inputs(num_attributes); //all values initialized, we need more than num_attributees because not all of them are used, which we do not consider
+	conn >> num_cmps;
+	vector<uint32_t> attribute_bits(num_attributes); //comparison bit width of every attribute
+	vector<uint64_t> attribute_offsets(num_attributes); //added to every input, see DecTree::read_from_file
+	uint32_t input_bits = 0, max_bits = 0;
 	for(uint32_t j = 0; j < num_attributes; ++j){
-		client_inputs[j] = rg.get64() % 10000;
-		//cout << j << " " << client_inputs[j] << endl;
+		conn >> attribute_bits[j] >> attribute_offsets[j];
+		input_bits += attribute_bits[j];
+		max_bits = std::max(max_bits, attribute_bits[j]);
+	}
+	int64_t label_min, label_max;
+	conn >> label_min;
+	conn >> label_max;
+	if(!conn || label_min > label_max || label_min < -max_label || label_max > max_label){ //sizes the decryption table
+		throw cybozu::Exception("hhh:play_client:bad label range") << label_min << label_max;
+	}
+	int compress_offered;
+	conn >> compress_offered;
+	string curve;
+	conn >> curve;
+	if(curve != HHHGroup::name()){
+		throw cybozu::Exception("hhh:play_client:server uses another curve") << curve << HHHGroup::name();
+	}
+
+	const uint32_t num_queries = PROT == 0 ? client_queries : 1; //HH(G) and (GG)H exchange shares of one query via files
+	vector< vector<uint64_t> > client_inputs(num_queries, vector<uint64_t>(num_attributes)); //one feature vector per query
+	for(uint32_t q = 0; q < num_queries; ++q){
+		if(q > 0 && client_changes > 0){ //the previous record with client_changes attributes drawn anew
+			client_inputs[q] = client_inputs[q - 1];
+			for(uint32_t c = 0; c < client_changes; ++c){
+				const uint32_t j = rg.get32() % num_attributes;
+				client_inputs[q][j] = rg.get64() % 10000;
+			}
+			continue;
+		}
+		for(uint32_t j = 0; j < num_attributes; ++j){
+			client_inputs[q][j] = rg.get64() % 10000;
+			//cout << j << " " << client_inputs[q][j] << endl;
+		}
 	}
 	//tree.evaluate(client_inputs);
 
 	timeval tbegin, tend;
 
-	const mcl::EcParam& para = mcl::ecparam::secp256k1;
-	const Fp x0(para.gx);
-	const Fp y0(para.gy);
-	const Ec P(x0, y0);
+	const Ec P = HHHGroup::generator();
 
 	Elgamal::PrivateKey prv;
-	prv.init(P, para.bitSize, rg);
+	const bool use_store = prepareStoreDir();
+	if(use_store){
+		loadClientKey(prv, P, HHHGroup::bitSize()); //stored material is bound to the key
+	}
+	else{
+		prv.init(P, HHHGroup::bitSize(), rg);
+	}
 	const Elgamal::PublicKey& pub = prv.getPublicKey();
 
+	const bool compress = compress_offered != 0 && COMPRESS;
+	conn << compress << '\n'; //accepts or declines compressed frames
+	const Channel ch = {conn, compress};
 	conn << pub << '\n'; //sends public key
+	conn << num_queries << '\n';
+
+	OfflineStore<Elgamal> offline_store;
+	if(use_store){
+		openOfflineStore(offline_store, store_role_client, pub, num_attributes, num_cmps, storePerQuery(store_role_client, input_bits, num_cmps));
+	}
 
 	//COMPARISON OFFLINE
 	gettimeofday(&tbegin, NULL);
-	vector< vector<Elgamal::CipherText> > enc_bits(num_attributes);
+	//enough encryptions of each bit value for one query, refilled in the background once a quarter is left
+	BitCipherPool<Elgamal> bit_pool(pub, input_bits / 4, input_bits);
 	if(PROT == 0 || PROT == 1){
-		for(uint32_t j = 0; j < num_attributes; ++j){
-			enc_bits[j] = encBitbyBitPrecomp(pub);
-		}
+		vector<Elgamal::CipherText> zeros(2 * input_bits);
+		zeros.resize(offline_store.take(zeros.data(), zeros.size()));
+		bit_pool.fill(zeros);
+		bit_pool.start();
 
 		gettimeofday(&tend, NULL);
-		cout << "Comp Offline: " << ((tend.tv_sec-tbegin.tv_sec)*1000000 + tend.tv_usec - tbegin.tv_usec)/1000 << "ms" << endl;
+		cout << "Comp Offline: " << ((tend.tv_sec-tbegin.tv_sec)*1000000 + tend.tv_usec - tbegin.tv_usec)/1000 << "ms"
+			<< " (store: " << zeros.size() << " of " << 2 * input_bits << ")" << endl;
 	}
 
 	//EVAL OFFLINE
 	gettimeofday(&tbegin, NULL);
-	vector< std::vector<Elgamal::CipherText> > gt_results_off(num_dec_nodes);
+	vector<Elgamal::CipherText> gt_results_off(num_cmps); //encryptions of 0 for the comparison bits of the next query
+	auto take_gt_results_off = [&](){
+		const size_t stored = offline_store.take(gt_results_off.data(), num_cmps);
+		pub.encOffBatch(gt_results_off.data() + stored, num_cmps - stored, rg);
+	};
+	std::shared_ptr<Elgamal::Bsgs> labels = std::make_shared<Elgamal::Bsgs>(); //read-only once built, decrypts the leaf label
 	if(PROT == 0 || PROT == 2){
-		for(uint32_t j = 0; j < num_dec_nodes; ++j){
-			gt_results_off[j].resize(1);
-			pub.enc_off(gt_results_off[j][0], rg);
-		}
+		take_gt_results_off();
+		labels->init(pub.getF(), (int)label_min, (int)label_max);
 		gettimeofday(&tend, NULL);
 		cout << "Eval Offline: " << ((tend.tv_sec-tbegin.tv_sec)*1000000 + tend.tv_usec - tbegin.tv_usec)/1000 << "ms" << endl;
 	}
 
-	//COMPARISON ONLINE
-	gettimeofday(&tbegin, NULL);
-	vector< std::vector<Elgamal::CipherText> > gt_results(num_dec_nodes);
-	vector<uint32_t> client_out(num_dec_nodes);
-	if(PROT == 0 || PROT == 1){
+	//encrypts and sends the attributes of query q that differ from query q - 1, see receiveInputs and serveSession
+	vector< vector<Elgamal::CipherText> > enc_bits(num_attributes);
+	uint64_t attributes_sent = 0;
+	auto send_inputs = [&](uint32_t q){
+		vector<uint32_t> changed;
 		for(uint32_t j = 0; j < num_attributes; ++j){
-			encBitbyBitOnline(pub, enc_bits[j], client_inputs[j]);
-			send_ctxts(enc_bits[j], conn);
+			if(q == 0 || client_inputs[q][j] != client_inputs[q - 1][j]){
+				changed.push_back(j);
+			}
+		}
+		conn << changed.size();
+		for(size_t i = 0; i < changed.size(); ++i){
+			conn << ' ' << changed[i];
+		}
+		conn << '\n';
+		conn.flush();
+		for(size_t i = 0; i < changed.size(); ++i){
+			const uint32_t j = changed[i];
+			encBitsPool(bit_pool, enc_bits[j], client_inputs[q][j] + attribute_offsets[j], attribute_bits[j]);
+			send_ctxts(enc_bits[j], ch);
 		}
+		attributes_sent += changed.size();
+	};
 
-		for(uint32_t j = 0; j < num_dec_nodes; ++j){
-			receive_ctxts(gt_results[j], bitlen, conn);
-			client_out[j] = PvtCmpC(prv, gt_results[j]);
-			//cout << client_out[j] << endl; CHECKED CORRECT
+	const bool lookahead = (PROT == 0 && !STREAM) || PROT == 1; //streamed queries run one after the other
+	uint64_t eval_offline_us = 0, comp_online_us = 0, eval_online_us = 0;
+	vector<Zn> results(num_queries);
+	timeval tbegin_online, tend_online;
+	gettimeofday(&tbegin_online, NULL);
+	for(uint32_t q = 0; q < num_queries; q++){
+		//EVAL OFFLINE of the queries after the first
+		gettimeofday(&tbegin, NULL);
+		if(q > 0 && (PROT == 0 || PROT == 2)){
+			take_gt_results_off();
+			gettimeofday(&tend, NULL);
+			eval_offline_us += elapsedUs(tbegin, tend);
 		}
 
-		gettimeofday(&tend, NULL);
-		cout << "Comp Online: " << ((tend.tv_sec-tbegin.tv_sec)*1000000 + tend.tv_usec - tbegin.tv_usec)/1000 << "ms" << endl;
-	}
-	if(PROT == 1){
-		ofstream output_shares;
-		output_shares.open("../../../output/compH_shares_client.txt");
-		for(uint32_t j = 0; j < num_dec_nodes; j++){
-			output_shares << client_out[j] << endl;
+		//COMPARISON ONLINE
+		gettimeofday(&tbegin, NULL);
+		vector< std::vector<Elgamal::CipherText> > gt_results(num_cmps);
+		vector<uint32_t> client_out(num_cmps);
+		if(PROT == 0 || PROT == 1){
+			if(q == 0 || !lookahead){
+				send_inputs(q);
+			}
+
+			if(PROT == 0 && STREAM){
+				//every comparison bit is reencrypted and sent back as soon as its result is in, see PvtCmpSParallel
+				for(uint32_t j = 0; j < num_cmps; ++j){
+					receive_ctxts(gt_results[j], max_bits, ch);
+					client_out[j] = PvtCmpC(prv, gt_results[j]);
+					pub.enc_on(gt_results_off[j], client_out[j]);
+					send_ctxts(vector<Elgamal::CipherText>(1, gt_results_off[j]), ch);
+				}
+			}
+			else{
+				if(lookahead && q + 1 < num_queries){ //the server compares on query q meanwhile
+					send_inputs(q + 1);
+				}
+				for(uint32_t j = 0; j < num_cmps; ++j){
+					receive_ctxts(gt_results[j], max_bits, ch);
+					client_out[j] = PvtCmpC(prv, gt_results[j]);
+					//cout << client_out[j] << endl; CHECKED CORRECT
+				}
+			}
+			gettimeofday(&tend, NULL);
+			comp_online_us += elapsedUs(tbegin, tend);
 		}
-		output_shares.close();
-	}
-	if(PROT == 2){
-		ifstream output_shares;
-		char c;
-		output_shares.open("../../../output/compG_shares_client.txt");
-		uint32_t j = 0;
-		while(output_shares >> client_out[j]){
-			j++;
+		if(PROT == 1){
+			ofstream output_shares;
+			output_shares.open("../../../output/compH_shares_client.txt");
+			for(uint32_t j = 0; j < num_cmps; j++){
+				output_shares << client_out[j] << endl;
+			}
+			output_shares.close();
 		}
-		output_shares.close();
-	}
-
-	//EVAL ONLINE
-	gettimeofday(&tbegin, NULL);
-	vector<Elgamal::CipherText> pathCost(num_dec_nodes + 1); //path costs on the leaves only!
-	vector<Elgamal::CipherText> classif(num_dec_nodes + 1); //classification on the leaves only!
-	Zn result;
-	if(PROT == 0 || PROT == 2){
-		for(uint32_t j = 0; j < num_dec_nodes; ++j){
-			pub.enc_on(gt_results_off[j][0], client_out[j]);
-			//pub.enc(gt_results[j][0], client_out[j], rg);
-			send_ctxts(gt_results_off[j], conn);
+		if(PROT == 2){
+			ifstream output_shares;
+			char c;
+			output_shares.open("../../../output/compG_shares_client.txt");
+			uint32_t j = 0;
+			while(output_shares >> client_out[j]){
+				j++;
+			}
+			output_shares.close();
 		}
-		receive_ctxts(pathCost, num_dec_nodes + 1, conn);
-		receive_ctxts(classif, num_dec_nodes + 1, conn);
 
-		for(uint32_t j = 0; j < pathCost.size(); ++j){
-			if(prv.isZeroMessage(pathCost[j])){
-				prv.dec(result, classif[j], 1000);
+		//EVAL ONLINE
+		gettimeofday(&tbegin, NULL);
+		if(PROT == 0 || PROT == 2){
+			vector<Elgamal::CipherText> pathCost(num_dec_nodes + 1); //path costs on the leaves only!
+			vector<Elgamal::CipherText> classif(num_dec_nodes + 1); //classification on the leaves only!
+			if(!(PROT == 0 && STREAM)){ //streamed bits were sent with the comparison results
+				for(uint32_t j = 0; j < num_cmps; ++j){
+					pub.enc_on(gt_results_off[j], client_out[j]);
+					//pub.enc(gt_results[j][0], client_out[j], rg);
+				}
+				send_ctxts(gt_results_off, ch); //one message for all comparison bits
 			}
+			receive_ctxts(pathCost, num_dec_nodes + 1, ch);
+			receive_ctxts(classif, num_dec_nodes + 1, ch);
+
+			const size_t j = prv.findZeroMessage(pathCost);
+			if(j < pathCost.size()){
+				prv.dec(results[q], classif[j], *labels);
+			}
+			gettimeofday(&tend, NULL);
+			eval_online_us += elapsedUs(tbegin, tend);
 		}
+	}
+	gettimeofday(&tend_online, NULL);
 
-		gettimeofday(&tend, NULL);
-		cout << "Eval Online: " << ((tend.tv_sec-tbegin.tv_sec)*1000000 + tend.tv_usec - tbegin.tv_usec)/1000 << "ms" << endl << endl;
-		cout << "Evaluation result: " << result << endl;
+	if(num_queries > 1 && (PROT == 0 || PROT == 2)){
+		cout << "Eval Offline (queries 2 to " << num_queries << "): " << eval_offline_us/1000 << "ms" << endl;
+	}
+	if(PROT == 0 || PROT == 1){
+		cout << "Comp Online" << (STREAM ? " (streamed reencryption)" : "") << ": " << comp_online_us/1000 << "ms" << endl;
+	}
+	if(PROT == 0 || PROT == 1){
+		cout << "Bit pool: " << bit_pool.hits() << " hits, " << bit_pool.misses() << " misses" << endl;
+	}
+	if(PROT == 0 || PROT == 2){
+		cout << "Eval Online: " << eval_online_us/1000 << "ms" << endl;
+	}
+	if(num_queries > 1){
+		const uint64_t total_us = elapsedUs(tbegin_online, tend_online);
+		cout << num_queries << " queries: " << total_us/1000 << "ms, " << total_us/num_queries/1000.0 << "ms per query, "
+			<< num_queries * 1000000.0 / total_us << " queries/s" << endl;
+		cout << "Attributes sent: " << attributes_sent << " of " << (uint64_t)num_queries * num_attributes << endl;
+	}
+	if(PROT == 0 || PROT == 2){
+		cout << endl;
+		for(uint32_t q = 0; q < num_queries; q++){
+			cout << "Evaluation result: " << results[q] << endl;
+		}
 	}
 }
 
 //CLIENTSERVER END
 
 int main(int argc, char *argv[]) {
-	long r = 0; //0 for server, 1 for client
+	long r = 0; //0 for server, 1 for client, 2 to fill the offline stores, 3 for server and client of one query in this process, 4 for the server daemon
 	if (argc > 1)
 		r = std::stol(argv[1]);
+	if (argc > 2 && r != 1 && r != 2)
+		cmp_threads = std::stoul(argv[2]);
+	client_model = argc > 2 && r == 1 ? string(argv[2]) : modelName(dt_files[DT]);
+	if (argc > 3 && r == 1)
+		client_queries = std::max(1ul, std::stoul(argv[3]));
+	if (argc > 4 && r == 1)
+		client_changes = std::stoul(argv[4]);
 	SysInit();
-	std::srand(std::time(0));
 
 	switch(r) {
 	case 0:
@@ -496,6 +1391,27 @@ int main(int argc, char *argv[]) {
 		std::cout << "connect to server..." << std::endl;
 		run_client(play_client);
 		break;
+	case 2:
+		std::cout << "filling offline stores..." << std::endl;
+		refillOfflineStores(argc > 2 ? std::stoul(argv[2]) : 1);
+		break;
+	case 3: //e.g. to compare the curves of several builds on the same tree, see curve.hpp
+		{
+			std::cout << "local query on " << HHHGroup::name() << "..." << std::endl;
+			timeval tbegin, tend;
+			gettimeofday(&tbegin, NULL);
+			std::thread server([]{ run_server(play_server); });
+			std::this_thread::sleep_for(std::chrono::milliseconds(200)); //until the server listens
+			run_client(play_client);
+			server.join();
+			gettimeofday(&tend, NULL);
+			std::cout << HHHGroup::name() << " total: " << ((tend.tv_sec-tbegin.tv_sec)*1000000 + tend.tv_usec - tbegin.tv_usec)/1000 << "ms" << std::endl;
+		}
+		break;
+	case 4:
+		std::cout << "starting server daemon..." << std::endl;
+		runServerDaemon(argc > 3 ? std::stoul(argv[3]) : daemon_sessions);
+		break;
 	}
 	return 0;
 }
@@ -0,0 +1,98 @@
+/**
+ \file 		lanes_bench.cpp
+ \author 	kiss@encrypto.cs.tu-darmstadt.de
+ \copyright	Lanes benchmark
+			Copyright (C) 2019 Cryptography and Privacy Engineering Group, TU Darmstadt
+			This program is free software: you can redistribute it and/or modify
+			it under the terms of the GNU Affero General Public License as published
+			by the Free Software Foundation, either version 3 of the License, or
+			(at your option) any later version.
+			This program is distributed in the hope that it will be useful,
+			but WITHOUT ANY WARRANTY; without even the implied warranty of
+			MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+			GNU Affero General Public License for more details.
+			You should have received a copy of the GNU Affero General Public License
+			along with this program. If not, see <http://www.gnu.org/licenses/>.
+ \brief		Compares batchAdd and batchMul with 64-bit scalars (the blinding of the server) of mcl, one
+			point at a time, with the AVX2 and AVX-512 IFMA lanes of ec_lanes.hpp on the group of HHH_CURVE,
+			to decide whether LANES in hhh.cpp pays off on this machine
+ */
+
+#include <iostream>
+#include <vector>
+#include <sys/time.h>
+#include "curve.hpp"
+#include "drbg.hpp"
+#include "ec_lanes.hpp"
+
+using namespace std;
+
+const size_t num_ctxts = 1024;
+const size_t num_rounds = 4;
+
+AesCtrDrbg rg;
+
+double elapsed_us(const timeval& tbegin, const timeval& tend){
+	return (tend.tv_sec - tbegin.tv_sec) * 1000000.0 + tend.tv_usec - tbegin.tv_usec;
+}
+
+//time per ciphertext of batchAdd and batchMul with the lane backend currently set, in us
+void benchBatch(const vector<Elgamal::CipherText>& ctxts, const Elgamal::CipherText& t, const vector<uint64_t>& x,
+		double& t_add, double& t_mul){
+	timeval tbegin, tend;
+	t_add = t_mul = 0;
+	for(size_t r = 0; r < num_rounds; r++){
+		vector<Elgamal::CipherText> c = ctxts;
+		Elgamal::CipherText::batchNormalize(c);
+		gettimeofday(&tbegin, NULL);
+		Elgamal::CipherText::batchAdd(c.data(), c.size(), t);
+		gettimeofday(&tend, NULL);
+		t_add += elapsed_us(tbegin, tend);
+		c = ctxts;
+		gettimeofday(&tbegin, NULL);
+		Elgamal::CipherText::batchMul(c.data(), c.size(), x.data());
+		gettimeofday(&tend, NULL);
+		t_mul += elapsed_us(tbegin, tend);
+	}
+	t_add /= num_rounds * ctxts.size();
+	t_mul /= num_rounds * ctxts.size();
+}
+
+int main(int argc, char *argv[]) {
+	HHHGroup::init();
+	Elgamal::PrivateKey prv;
+	prv.init(HHHGroup::generator(), HHHGroup::bitSize(), rg);
+	const Elgamal::PublicKey& pub = prv.getPublicKey();
+	vector<Elgamal::CipherText> ctxts(num_ctxts);
+	vector<uint64_t> x(num_ctxts);
+	for(size_t i = 0; i < ctxts.size(); i++){
+		pub.enc(ctxts[i], (int)(i % 2), rg);
+		x[i] = rg.get64();
+	}
+	Elgamal::CipherText t;
+	pub.enc(t, 1, rg);
+
+	const Elgamal::CipherText::LaneBackend none = {0, 0};
+	Elgamal::CipherText::setLaneBackend(none);
+	double mcl_add, mcl_mul;
+	benchBatch(ctxts, t, x, mcl_add, mcl_mul);
+	cout << HHHGroup::name() << ", " << num_ctxts << " ciphertexts" << endl;
+	cout << "mcl: batchAdd " << mcl_add << "us, batchMul " << mcl_mul << "us" << endl;
+
+	const EcLanes<Elgamal>::Isa isas[2] = {EcLanes<Elgamal>::avx2, EcLanes<Elgamal>::avx512ifma};
+	const char* names[2] = {"AVX2", "AVX-512 IFMA"};
+	for(int i = 0; i < 2; i++){
+		if(EcLanes<Elgamal>::init(isas[i]) != isas[i]){
+			Elgamal::CipherText::setLaneBackend(none);
+			cout << names[i] << ": skipped, not supported" << endl;
+			continue;
+		}
+		double lanes_add, lanes_mul;
+		benchBatch(ctxts, t, x, lanes_add, lanes_mul);
+		Elgamal::CipherText::setLaneBackend(none);
+		cout << names[i] << ": batchAdd " << lanes_add << "us (x" << mcl_add / lanes_add << "), batchMul "
+			<< lanes_mul << "us (x" << mcl_mul / lanes_mul << "), set LANES " << (int)isas[i]
+			<< (lanes_add < mcl_add && lanes_mul < mcl_mul ? " pays off" : " does not pay off") << endl;
+	}
+	return 0;
+}
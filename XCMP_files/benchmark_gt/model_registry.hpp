@@ -0,0 +1,246 @@
+/**
+ \file 		model_registry.hpp
+ \author 	kiss@encrypto.cs.tu-darmstadt.de
+ \copyright	Model registry
+			Copyright (C) 2019 Cryptography and Privacy Engineering Group, TU Darmstadt
+			This program is free software: you can redistribute it and/or modify
+			it under the terms of the GNU Affero General Public License as published
+			by the Free Software Foundation, either version 3 of the License, or
+			(at your option) any later version.
+			This program is distributed in the hope that it will be useful,
+			but WITHOUT ANY WARRANTY; without even the implied warranty of
+			MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+			GNU Affero General Public License for more details.
+			You should have received a copy of the GNU Affero General Public License
+			along with this program. If not, see <http://www.gnu.org/licenses/>.
+ \brief		Index of the models in a directory by name and version. The file <name> is version 0 of
+			model <name> and <name>.v<N> is version N, the registry serves the highest version of every
+			name. A reload thread rescans the directory, loads new or changed files without blocking
+			the sessions and then swaps them in. Sessions hold their model by a shared pointer, so a
+			replaced model lives until the last session on it has finished.
+ */
+
+#ifndef MODEL_REGISTRY_H_INCLUDED
+#define MODEL_REGISTRY_H_INCLUDED
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <dirent.h>
+#include <sys/stat.h>
+
+//splits a file name into model name and version, false for files that are not models
+inline bool parseModelFileName(const std::string& file, std::string& name, uint64_t& version){
+	if(file.empty() || file[0] == '.' || (file.size() > 4 && file.compare(file.size() - 4, 4, ".tmp") == 0)){
+		return false; //hidden files and files still being written, publish a model by renaming its .tmp file
+	}
+	name = file;
+	version = 0;
+	const size_t dot = file.rfind(".v");
+	if(dot != std::string::npos && dot > 0 && dot + 2 < file.size()
+		&& file.find_first_not_of("0123456789", dot + 2) == std::string::npos){
+		name = file.substr(0, dot);
+		version = strtoull(file.c_str() + dot + 2, 0, 10);
+	}
+	return true;
+}
+
+template<class Model>
+class ModelRegistry {
+  public:
+	//fills model from file, returns false (or throws) if file does not hold a valid model
+	typedef std::function<bool(Model&, const std::string&)> Loader;
+
+	struct Entry {
+		std::string name;
+		uint64_t version;
+	};
+
+	/**
+	 * @param dir directory of the model files
+	 * @param poll_seconds interval of the reload thread, 0 to scan only when scan is called
+	 */
+	ModelRegistry(const std::string& dir, const Loader& loader, uint32_t poll_seconds);
+	~ModelRegistry();
+
+	/**
+	 * Loads every model whose latest file is not the one served, i.e. new names, new versions, files
+	 * rewritten in place and, if the latest version was removed, the one before it. Models whose file
+	 * was removed altogether stay served. Returns the number of models swapped in.
+	 */
+	size_t scan();
+
+	/**
+	 * Latest version of the model name, null if there is none. The model is shared with all other
+	 * sessions on it.
+	 */
+	std::shared_ptr<const Model> get(const std::string& name, uint64_t* version = 0);
+
+	std::vector<Entry> models();
+
+  private:
+	struct Stamp {
+		uint64_t version;
+		time_t mtime;
+		bool operator==(const Stamp& other) const {
+			return version == other.version && mtime == other.mtime;
+		}
+	};
+	struct Slot {
+		Stamp stamp;
+		std::shared_ptr<Model> model;
+	};
+
+	void reload();
+
+	const std::string dir;
+	const Loader loader;
+	const uint32_t poll_seconds;
+	std::map<std::string, Slot> slots;
+	std::map<std::string, Stamp> failed; //latest file of a name that did not load, tried again once it changes
+	std::mutex scan_mtx; //one scan at a time
+	std::thread reload_thread;
+	std::mutex mtx;
+	std::condition_variable cv;
+	bool stopping;
+};
+
+template<class Model>
+ModelRegistry<Model>::ModelRegistry(const std::string& dir, const Loader& loader, uint32_t poll_seconds)
+  : dir(dir)
+  , loader(loader)
+  , poll_seconds(poll_seconds)
+  , stopping(false)
+{
+	if(poll_seconds > 0){
+		reload_thread = std::thread(&ModelRegistry<Model>::reload, this);
+	}
+}
+
+template<class Model>
+ModelRegistry<Model>::~ModelRegistry(){
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		stopping = true;
+	}
+	cv.notify_all();
+	if(reload_thread.joinable()){
+		reload_thread.join();
+	}
+}
+
+template<class Model>
+size_t ModelRegistry<Model>::scan(){
+	std::lock_guard<std::mutex> scan_lock(scan_mtx);
+	//latest file of every name
+	std::map<std::string, std::pair<Stamp, std::string> > latest;
+	DIR* d = opendir(dir.c_str());
+	if(!d){
+		return 0;
+	}
+	while(struct dirent* e = readdir(d)){
+		std::string name;
+		Stamp stamp;
+		if(!parseModelFileName(e->d_name, name, stamp.version)){
+			continue;
+		}
+		const std::string file = dir + "/" + e->d_name;
+		struct stat st;
+		if(stat(file.c_str(), &st) != 0 || !S_ISREG(st.st_mode)){
+			continue;
+		}
+		stamp.mtime = st.st_mtime;
+		typename std::map<std::string, std::pair<Stamp, std::string> >::iterator it = latest.find(name);
+		if(it == latest.end() || stamp.version > it->second.first.version){
+			latest[name] = std::make_pair(stamp, file);
+		}
+	}
+	closedir(d);
+
+	size_t swapped = 0;
+	for(typename std::map<std::string, std::pair<Stamp, std::string> >::iterator it = latest.begin(); it != latest.end(); ++it){
+		const Stamp& stamp = it->second.first;
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			typename std::map<std::string, Slot>::iterator slot = slots.find(it->first);
+			if(slot != slots.end() && slot->second.stamp == stamp){
+				continue;
+			}
+		}
+		typename std::map<std::string, Stamp>::iterator f = failed.find(it->first);
+		if(f != failed.end() && f->second == stamp){
+			continue;
+		}
+		//loaded without the lock, sessions keep getting the old model meanwhile
+		std::shared_ptr<Model> model = std::make_shared<Model>();
+		bool ok;
+		try{
+			ok = loader(*model, it->second.second);
+		}
+		catch(std::exception&){
+			ok = false;
+		}
+		if(!ok){
+			failed[it->first] = stamp;
+			continue;
+		}
+		failed.erase(it->first);
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			Slot& slot = slots[it->first];
+			slot.stamp = stamp;
+			slot.model.swap(model);
+		}
+		model.reset(); //the old model is freed here or by the last session holding it
+		swapped++;
+	}
+	return swapped;
+}
+
+template<class Model>
+std::shared_ptr<const Model> ModelRegistry<Model>::get(const std::string& name, uint64_t* version){
+	std::lock_guard<std::mutex> lock(mtx);
+	typename std::map<std::string, Slot>::iterator it = slots.find(name);
+	if(it == slots.end()){
+		return std::shared_ptr<const Model>();
+	}
+	if(version){
+		*version = it->second.stamp.version;
+	}
+	return it->second.model;
+}
+
+template<class Model>
+std::vector<typename ModelRegistry<Model>::Entry> ModelRegistry<Model>::models(){
+	std::lock_guard<std::mutex> lock(mtx);
+	std::vector<Entry> entries;
+	for(typename std::map<std::string, Slot>::iterator it = slots.begin(); it != slots.end(); ++it){
+		Entry e = {it->first, it->second.stamp.version};
+		entries.push_back(e);
+	}
+	return entries;
+}
+
+template<class Model>
+void ModelRegistry<Model>::reload(){
+	std::unique_lock<std::mutex> lock(mtx);
+	while(!stopping){
+		cv.wait_for(lock, std::chrono::seconds(poll_seconds));
+		if(stopping){
+			break;
+		}
+		lock.unlock();
+		scan();
+		lock.lock();
+	}
+}
+
+#endif // MODEL_REGISTRY_H_INCLUDED
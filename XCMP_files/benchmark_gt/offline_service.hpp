@@ -0,0 +1,260 @@
+/**
+ \file 		offline_service.hpp
+ \author 	kiss@encrypto.cs.tu-darmstadt.de
+ \copyright	Offline precomputation service
+			Copyright (C) 2019 Cryptography and Privacy Engineering Group, TU Darmstadt
+			This program is free software: you can redistribute it and/or modify
+			it under the terms of the GNU Affero General Public License as published
+			by the Free Software Foundation, either version 3 of the License, or
+			(at your option) any later version.
+			This program is distributed in the hope that it will be useful,
+			but WITHOUT ANY WARRANTY; without even the implied warranty of
+			MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+			GNU Affero General Public License for more details.
+			You should have received a copy of the GNU Affero General Public License
+			along with this program. If not, see <http://www.gnu.org/licenses/>.
+ \brief		Producer thread that keeps a bounded queue of input-independent offline
+			bundles per key (e.g. client public key and tree shape), so that a session
+			can take its offline material ready-made and start its online phase at once.
+			Only keys with a live session or seen in more than one session are refilled,
+			so the thread does not spend time on keys that are used once, e.g. per-run client keys.
+ */
+
+#ifndef OFFLINE_SERVICE_H_INCLUDED
+#define OFFLINE_SERVICE_H_INCLUDED
+
+#include <stdint.h>
+#include <string>
+#include <map>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <iostream>
+#include <exception>
+#include "drbg.hpp"
+
+template<class Bundle>
+class OfflineService {
+  public:
+	typedef std::function<void(Bundle&, AesCtrDrbg&)> Producer;
+
+	/**
+	 * @param capacity number of bundles kept ready per key
+	 * @param max_keys number of keys served, the least recently used key is dropped beyond that
+	 */
+	OfflineService(size_t capacity, size_t max_keys);
+	~OfflineService();
+
+	/**
+	 * Takes a bundle for key. On a miss the bundle is produced in the calling thread.
+	 * Afterwards the producer thread keeps the queue of key filled using producer, as long
+	 * as key is refilled at all, see Session.
+	 */
+	void acquire(const std::string& key, const Producer& producer, Bundle& out);
+
+	//marks key as used by a live session for its lifetime
+	class Session {
+	  public:
+		Session(OfflineService& service, const std::string& key) : service(service), key(key) { service.open(key); }
+		~Session(){ service.close(key); }
+	  private:
+		Session(const Session&);
+		Session& operator=(const Session&);
+		OfflineService& service;
+		const std::string key;
+	};
+
+	uint64_t hits();
+	uint64_t misses();
+
+  private:
+	struct Queue {
+		Producer producer; //empty until the first acquire and after the producer failed
+		std::deque<Bundle> bundles;
+		uint64_t last_use;
+		bool producing;
+		uint32_t sessions; //live sessions of the key
+		uint64_t sessions_seen;
+		Queue() : last_use(0), producing(false), sessions(0), sessions_seen(0) {}
+	};
+	typedef std::map<std::string, Queue> QueueMap;
+
+	void open(const std::string& key);
+	void close(const std::string& key);
+	void produce();
+	typename QueueMap::iterator find_or_insert(const std::string& key);
+	typename QueueMap::iterator next_to_fill();
+
+	const size_t capacity;
+	const size_t max_keys;
+	QueueMap queues;
+	uint64_t num_hits;
+	uint64_t num_misses;
+	uint64_t clock;
+	AesCtrDrbg producer_rng;
+	std::thread producer_thread;
+	std::mutex mtx;
+	std::condition_variable cv;
+	bool stopping;
+};
+
+template<class Bundle>
+OfflineService<Bundle>::OfflineService(size_t capacity, size_t max_keys)
+  : capacity(capacity)
+  , max_keys(max_keys)
+  , num_hits(0)
+  , num_misses(0)
+  , clock(0)
+  , stopping(false)
+{
+	producer_thread = std::thread(&OfflineService<Bundle>::produce, this);
+}
+
+template<class Bundle>
+OfflineService<Bundle>::~OfflineService(){
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		stopping = true;
+	}
+	cv.notify_all();
+	producer_thread.join();
+}
+
+template<class Bundle>
+void OfflineService<Bundle>::acquire(const std::string& key, const Producer& producer, Bundle& out){
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		typename QueueMap::iterator it = find_or_insert(key);
+		if(!it->second.producer){
+			it->second.producer = producer;
+		}
+		it->second.last_use = clock++;
+		if(!it->second.bundles.empty()){
+			out = it->second.bundles.front();
+			it->second.bundles.pop_front();
+			num_hits++;
+			cv.notify_one();
+			return;
+		}
+		num_misses++;
+		cv.notify_one();
+	}
+	AesCtrDrbg rng;
+	producer(out, rng);
+}
+
+template<class Bundle>
+void OfflineService<Bundle>::open(const std::string& key){
+	std::lock_guard<std::mutex> lock(mtx);
+	typename QueueMap::iterator it = find_or_insert(key);
+	it->second.sessions++;
+	it->second.sessions_seen++;
+	it->second.last_use = clock++;
+	cv.notify_one();
+}
+
+template<class Bundle>
+void OfflineService<Bundle>::close(const std::string& key){
+	std::lock_guard<std::mutex> lock(mtx);
+	typename QueueMap::iterator it = queues.find(key);
+	if(it != queues.end() && it->second.sessions > 0){
+		it->second.sessions--;
+	}
+}
+
+/**
+ * Queue of key, created if it does not exist yet. Beyond max_keys the least recently used key that is
+ * neither being filled nor used by a live session is dropped first.
+ */
+template<class Bundle>
+typename OfflineService<Bundle>::QueueMap::iterator OfflineService<Bundle>::find_or_insert(const std::string& key){
+	typename QueueMap::iterator it = queues.find(key);
+	if(it != queues.end()){
+		return it;
+	}
+	if(queues.size() >= max_keys){
+		typename QueueMap::iterator lru = queues.end();
+		for(typename QueueMap::iterator q = queues.begin(); q != queues.end(); ++q){
+			if(!q->second.producing && q->second.sessions == 0 && (lru == queues.end() || q->second.last_use < lru->second.last_use)){
+				lru = q;
+			}
+		}
+		if(lru != queues.end()){
+			queues.erase(lru);
+		}
+	}
+	return queues.insert(std::make_pair(key, Queue())).first;
+}
+
+template<class Bundle>
+uint64_t OfflineService<Bundle>::hits(){
+	std::lock_guard<std::mutex> lock(mtx);
+	return num_hits;
+}
+
+template<class Bundle>
+uint64_t OfflineService<Bundle>::misses(){
+	std::lock_guard<std::mutex> lock(mtx);
+	return num_misses;
+}
+
+/**
+ * Queue with the fewest bundles below capacity among those refilled, i.e. with a producer and a live session
+ * or seen in more than one session, end() if there is none
+ */
+template<class Bundle>
+typename OfflineService<Bundle>::QueueMap::iterator OfflineService<Bundle>::next_to_fill(){
+	typename QueueMap::iterator next = queues.end();
+	for(typename QueueMap::iterator q = queues.begin(); q != queues.end(); ++q){
+		const bool refilled = q->second.producer && (q->second.sessions > 0 || q->second.sessions_seen > 1);
+		if(refilled && q->second.bundles.size() < capacity && (next == queues.end() || q->second.bundles.size() < next->second.bundles.size())){
+			next = q;
+		}
+	}
+	return next;
+}
+
+/**
+ * Producer thread: produces one bundle at a time, without holding the lock,
+ * for the emptiest queue until all queues are at capacity. A producer that throws
+ * is logged and not called again until the next acquire of its key.
+ */
+template<class Bundle>
+void OfflineService<Bundle>::produce(){
+	std::unique_lock<std::mutex> lock(mtx);
+	for(;;){
+		cv.wait(lock, [this]{ return stopping || next_to_fill() != queues.end(); });
+		if(stopping){
+			return;
+		}
+		typename QueueMap::iterator q = next_to_fill();
+		Producer make = q->second.producer;
+		q->second.producing = true;
+		lock.unlock();
+		Bundle bundle;
+		bool ok = true;
+		try{
+			make(bundle, producer_rng);
+		}
+		catch(std::exception& e){
+			std::cout << "offline service: producer failed: " << e.what() << std::endl;
+			ok = false;
+		}
+		catch(...){
+			std::cout << "offline service: producer failed" << std::endl;
+			ok = false;
+		}
+		lock.lock();
+		q->second.producing = false; //q was not erased while producing was set
+		if(ok){
+			q->second.bundles.push_back(bundle);
+		}
+		else{
+			q->second.producer = Producer();
+		}
+	}
+}
+
+#endif // OFFLINE_SERVICE_H_INCLUDED
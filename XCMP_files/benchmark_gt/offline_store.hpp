@@ -0,0 +1,311 @@
+/**
+ \file 		offline_store.hpp
+ \author 	kiss@encrypto.cs.tu-darmstadt.de
+ \copyright	Offline material store
+			Copyright (C) 2019 Cryptography and Privacy Engineering Group, TU Darmstadt
+			This program is free software: you can redistribute it and/or modify
+			it under the terms of the GNU Affero General Public License as published
+			by the Free Software Foundation, either version 3 of the License, or
+			(at your option) any later version.
+			This program is distributed in the hope that it will be useful,
+			but WITHOUT ANY WARRANTY; without even the implied warranty of
+			MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+			GNU Affero General Public License for more details.
+			You should have received a copy of the GNU Affero General Public License
+			along with this program. If not, see <http://www.gnu.org/licenses/>.
+ \brief		Versioned on-disk store of precomputed encryptions of 0 (enc_off material)
+			for one party, public key and tree shape (attributes and comparisons). The file is memory-mapped and
+			every entry is marked as consumed on disk before it is handed out, so an
+			entry is never used twice, not even across restarts. Takes hold an exclusive flock on the
+			file, so parties in other processes mapping the same file never take the same entry.
+ */
+
+#ifndef OFFLINE_STORE_H_INCLUDED
+#define OFFLINE_STORE_H_INCLUDED
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+/*
+	file layout
+	StoreHeader | public key string (pub_len bytes) | state byte per entry (capacity bytes) | entries (capacity * ctxt_len bytes)
+	an entry is consumed iff its state byte is not 0
+*/
+struct StoreHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t role; //0 for server, 1 for client
+	uint32_t ctxt_len; //bytes per ciphertext, see ElgamalT::CipherText::saveFixed
+	uint32_t num_attributes;
+	uint32_t num_cmps; //distinct comparisons of the tree, see DecTree::compile
+	uint32_t per_query; //entries consumed by one query
+	uint64_t key_hash;
+	uint64_t pub_len;
+	uint64_t capacity;
+	uint64_t next; //all entries before next are consumed
+};
+
+const char store_magic[8] = {'H', 'H', 'H', 'S', 'T', 'O', 'R', 'E'};
+const uint32_t store_version = 1;
+
+//FNV-1a, used to key files by public key
+inline uint64_t hash_str(const std::string& str){
+	uint64_t h = 14695981039346656037ULL;
+	for(size_t i = 0; i < str.size(); i++){
+		h ^= (uint8_t)str[i];
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+//makes dir owner-only, false if it is not a directory of this user
+inline bool prepare_private_dir(const std::string& dir){
+	struct stat st;
+	return stat(dir.c_str(), &st) == 0 && S_ISDIR(st.st_mode) && st.st_uid == geteuid() && chmod(dir.c_str(), S_IRWXU) == 0;
+}
+
+template<class Elgamal>
+class OfflineStore {
+  public:
+	typedef typename Elgamal::CipherText CipherText;
+
+	OfflineStore() : fd(-1), base(0), len(0), locks(0) {}
+	~OfflineStore(){ close(); }
+
+	static std::string path(const std::string& dir, uint32_t role, const std::string& pub_str, uint32_t num_attributes, uint32_t num_cmps);
+
+	//maps the store file, returns false if it does not exist or does not match this build
+	bool open(const std::string& file);
+	//as open, but also false if the store is not the one of role, pub_str and the tree shape
+	bool open(const std::string& file, uint32_t role, const std::string& pub_str, uint32_t num_attributes, uint32_t num_cmps);
+	void close();
+	bool is_open() const { return base != 0; }
+	//false if file no longer names the mapped file, i.e. it was replaced by write since open
+	bool is_current(const std::string& file) const;
+	//exclusive lock of the file against other processes, nests with the lock of take, released by unlock or close
+	bool lock();
+	void unlock();
+
+	const StoreHeader& header() const { return *(const StoreHeader*)base; }
+	std::string pub_str() const { return std::string(base + sizeof(StoreHeader), header().pub_len); }
+	//number of entries not consumed yet
+	size_t available();
+	//takes up to n entries into out[0..], marks them consumed on disk first, returns the number taken
+	size_t take(CipherText* out, size_t n);
+
+	//atomically replaces file by a store holding entries
+	static bool write(const std::string& file, uint32_t role, const std::string& pub_str, uint32_t num_attributes,
+			uint32_t num_cmps, uint32_t per_query, const std::vector<CipherText>& entries);
+
+  private:
+	StoreHeader& hdr(){ return *(StoreHeader*)base; }
+	char* states(){ return base + sizeof(StoreHeader) + header().pub_len; }
+	char* entries(){ return states() + header().capacity; }
+	bool acquire();
+	void release();
+
+	int fd;
+	char* base;
+	size_t len;
+	uint32_t locks; //nesting depth of the file lock
+	std::mutex mtx;
+};
+
+template<class Elgamal>
+std::string OfflineStore<Elgamal>::path(const std::string& dir, uint32_t role, const std::string& pub_str, uint32_t num_attributes, uint32_t num_cmps){
+	char name[96];
+	snprintf(name, sizeof(name), "/hhh_%s_%016llx_%u_%u.store", role == 0 ? "server" : "client",
+		(unsigned long long)hash_str(pub_str), num_attributes, num_cmps);
+	return dir + name;
+}
+
+template<class Elgamal>
+bool OfflineStore<Elgamal>::open(const std::string& file){
+	close();
+	fd = ::open(file.c_str(), O_RDWR);
+	if(fd < 0){
+		return false;
+	}
+	struct stat st;
+	//stores of other users are not used, older stores written with the umask become owner-only
+	if(fstat(fd, &st) != 0 || st.st_uid != geteuid() || fchmod(fd, S_IRUSR | S_IWUSR) != 0
+		|| (size_t)st.st_size < sizeof(StoreHeader)){
+		close();
+		return false;
+	}
+	len = st.st_size;
+	void* p = mmap(0, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if(p == MAP_FAILED){
+		close();
+		return false;
+	}
+	base = (char*)p;
+	const StoreHeader& h = header();
+	const size_t body = len - sizeof(StoreHeader);
+	if(memcmp(h.magic, store_magic, sizeof(store_magic)) != 0 || h.version != store_version
+		|| h.ctxt_len != CipherText::getFixedByteSize() || h.pub_len > body
+		|| h.capacity != (body - h.pub_len) / (1 + h.ctxt_len) || body != h.pub_len + h.capacity * (1 + h.ctxt_len)){
+		close();
+		return false;
+	}
+	return true;
+}
+
+template<class Elgamal>
+bool OfflineStore<Elgamal>::open(const std::string& file, uint32_t role, const std::string& pub_str, uint32_t num_attributes, uint32_t num_cmps){
+	if(!open(file)){
+		return false;
+	}
+	//the file name holds only a hash of the key, entries of another key must never be taken
+	const StoreHeader& h = header();
+	if(h.role != role || h.num_attributes != num_attributes || h.num_cmps != num_cmps
+		|| h.key_hash != hash_str(pub_str) || this->pub_str() != pub_str){
+		close();
+		return false;
+	}
+	return true;
+}
+
+template<class Elgamal>
+void OfflineStore<Elgamal>::close(){
+	if(base){
+		munmap(base, len);
+		base = 0;
+	}
+	if(fd >= 0){
+		::close(fd); //drops the file lock too
+		fd = -1;
+	}
+	locks = 0;
+}
+
+template<class Elgamal>
+bool OfflineStore<Elgamal>::is_current(const std::string& file) const {
+	struct stat mapped, named;
+	return fd >= 0 && fstat(fd, &mapped) == 0 && stat(file.c_str(), &named) == 0
+		&& mapped.st_dev == named.st_dev && mapped.st_ino == named.st_ino;
+}
+
+template<class Elgamal>
+bool OfflineStore<Elgamal>::acquire(){
+	if(fd < 0){
+		return false;
+	}
+	if(locks == 0 && flock(fd, LOCK_EX) != 0){
+		return false;
+	}
+	locks++;
+	return true;
+}
+
+template<class Elgamal>
+void OfflineStore<Elgamal>::release(){
+	if(locks > 0 && --locks == 0){
+		flock(fd, LOCK_UN);
+	}
+}
+
+template<class Elgamal>
+bool OfflineStore<Elgamal>::lock(){
+	std::lock_guard<std::mutex> lock(mtx);
+	return acquire();
+}
+
+template<class Elgamal>
+void OfflineStore<Elgamal>::unlock(){
+	std::lock_guard<std::mutex> lock(mtx);
+	release();
+}
+
+template<class Elgamal>
+size_t OfflineStore<Elgamal>::available(){
+	std::lock_guard<std::mutex> lock(mtx);
+	size_t n = 0;
+	for(uint64_t i = header().next; i < header().capacity; i++){
+		n += states()[i] == 0;
+	}
+	return n;
+}
+
+template<class Elgamal>
+size_t OfflineStore<Elgamal>::take(CipherText* out, size_t n){
+	std::lock_guard<std::mutex> lock(mtx);
+	if(!base || !acquire()){ //nothing is taken without the file lock
+		return 0;
+	}
+	const uint64_t first = hdr().next;
+	std::vector<uint64_t> taken;
+	for(uint64_t i = first; i < hdr().capacity && taken.size() < n; i++){
+		if(states()[i] == 0){
+			states()[i] = 1;
+			taken.push_back(i);
+		}
+	}
+	hdr().next = taken.empty() ? first : taken.back() + 1;
+	//consumed marks reach the disk before any entry is used
+	const size_t page = sysconf(_SC_PAGESIZE);
+	const size_t end = states() + hdr().next - base;
+	msync(base, (end + page - 1) / page * page, MS_SYNC);
+	release();
+	for(size_t k = 0; k < taken.size(); k++){
+		out[k].loadFixed(entries() + taken[k] * hdr().ctxt_len);
+	}
+	return taken.size();
+}
+
+template<class Elgamal>
+bool OfflineStore<Elgamal>::write(const std::string& file, uint32_t role, const std::string& pub_str, uint32_t num_attributes,
+		uint32_t num_cmps, uint32_t per_query, const std::vector<CipherText>& entries){
+	StoreHeader h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, store_magic, sizeof(store_magic));
+	h.version = store_version;
+	h.role = role;
+	h.ctxt_len = CipherText::getFixedByteSize();
+	h.num_attributes = num_attributes;
+	h.num_cmps = num_cmps;
+	h.per_query = per_query;
+	h.key_hash = hash_str(pub_str);
+	h.pub_len = pub_str.size();
+	h.capacity = entries.size();
+	h.next = 0;
+
+	std::vector<char> body(h.capacity * (1 + h.ctxt_len), 0);
+	for(size_t i = 0; i < entries.size(); i++){
+		entries[i].saveFixed(&body[h.capacity + i * h.ctxt_len]);
+	}
+	//a tmp file of its own per writer, owner-only from its creation on: client entries become the input bit ciphertexts
+	std::string tmp = file + ".XXXXXX";
+	const int fd = mkstemp(&tmp[0]);
+	if(fd < 0){
+		return false;
+	}
+	FILE* fp = fchmod(fd, S_IRUSR | S_IWUSR) == 0 ? fdopen(fd, "wb") : NULL;
+	if(!fp){
+		::close(fd);
+		unlink(tmp.c_str());
+		return false;
+	}
+	bool ok = fwrite(&h, sizeof(h), 1, fp) == 1
+		&& fwrite(pub_str.data(), 1, pub_str.size(), fp) == pub_str.size()
+		&& fwrite(body.data(), 1, body.size(), fp) == body.size();
+	ok = fflush(fp) == 0 && fsync(fileno(fp)) == 0 && ok;
+	fclose(fp);
+	ok = ok && rename(tmp.c_str(), file.c_str()) == 0;
+	if(!ok){
+		unlink(tmp.c_str());
+	}
+	return ok;
+}
+
+#endif // OFFLINE_STORE_H_INCLUDED
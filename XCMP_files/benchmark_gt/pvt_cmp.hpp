@@ -0,0 +1,165 @@
+/**
+ \file 		pvt_cmp.hpp
+ \author 	kiss@encrypto.cs.tu-darmstadt.de
+ \copyright	Private comparison
+			Copyright (C) 2019 Cryptography and Privacy Engineering Group, TU Darmstadt
+			This program is free software: you can redistribute it and/or modify
+			it under the terms of the GNU Affero General Public License as published
+			by the Free Software Foundation, either version 3 of the License, or
+			(at your option) any later version.
+			This program is distributed in the hope that it will be useful,
+			but WITHOUT ANY WARRANTY; without even the implied warranty of
+			MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+			GNU Affero General Public License for more details.
+			You should have received a copy of the GNU Affero General Public License
+			along with this program. If not, see <http://www.gnu.org/licenses/>.
+ \brief		Server side of the DGK-style private comparison of HHH on bitwise encrypted inputs, the plain
+			version on bitlen bits and the version that takes the xor sums from a trie of the thresholds.
+ */
+
+#ifndef PVT_CMP_H_INCLUDED
+#define PVT_CMP_H_INCLUDED
+
+#include <stdint.h>
+#include <vector>
+#include <array>
+#include <algorithm>
+#include "curve.hpp"
+#include "drbg.hpp"
+
+const uint32_t bitlen = 64; //largest comparison bit width, trees compare every attribute on 8, 16, 32 or 64 bits, see DecTree::compile
+
+inline std::vector<int> getBits(uint64_t number){
+	std::vector<int> bits(bitlen);
+	for(uint32_t i = 0; i < bitlen; ++i){
+		bits[i] = (number >> (bitlen-i-1)) & 1;   
+	}
+	return bits;
+}
+
+inline Elgamal::CipherText xorWithConst(const Elgamal::PublicKey& pub, const Elgamal::CipherText& toXor, int thres, AesCtrDrbg& rng){
+	Elgamal::CipherText result(toXor);
+	if(thres == 1){
+		result.neg();
+		pub.add(result, 1);
+	}
+	else{
+		pub.rerandomize(result, rng);
+	}
+	return result;
+}
+
+inline std::vector<Elgamal::CipherText> PvtCmpS(const Elgamal::PublicKey& pub, Elgamal::CipherText& tmpsum, const std::vector<Elgamal::CipherText>& xenc, int64_t threshold, int server_bit,
+		AesCtrDrbg& rng){
+	std::vector<Elgamal::CipherText> result(bitlen); 
+	std::vector<int> yBits =  getBits(threshold); 
+	int32_t s = 1-2*server_bit; //BINDER
+	Elgamal::CipherText currentRes, xorRes;
+
+	for(uint32_t i = 0; i < bitlen; ++i){
+		currentRes = xenc[i];
+		pub.add(currentRes, s - yBits[i]); // x_i - y_i + s (latter two values known to server)
+		xorRes = xorWithConst(pub, xenc[i], yBits[i], rng); //y_i + x_i
+		xorRes.mul(3); //*3
+		if(i > 0){
+			currentRes.add(tmpsum);
+		}
+		tmpsum.add(xorRes);
+		result[i] = currentRes;
+	}
+	std::shuffle(result.begin(), result.end(), rng);
+	return result;
+}
+
+/**
+ * Bit-trie of the thresholds that are compared with one attribute. Trie node k stands for the prefix of
+ * the first depth[k] threshold bits (most significant first), node 0 is the empty prefix and parents
+ * come before their children. Prefixes of all bits of the attribute are not needed and not stored.
+ */
+struct ThresholdTrie {
+	std::vector<uint32_t> parent;
+	std::vector<int> bit; //last bit of the prefix, i.e. of the edge from the parent
+	std::vector<uint32_t> depth;
+	std::vector< std::array<int32_t, 2> > child;
+
+	ThresholdTrie() : parent(1, 0), bit(1, 0), depth(1, 0), child(1, std::array<int32_t, 2>{{-1, -1}}) {}
+
+	//adds the prefixes of the bits lowest bits of threshold, path[i] is set to the node of its prefix of length i
+	void insert(uint64_t threshold, uint32_t bits, std::vector<uint32_t>& path){
+		path.resize(bits);
+		uint32_t k = 0;
+		path[0] = 0;
+		for(uint32_t i = 1; i < bits; ++i){
+			const int b = (threshold >> (bits - i)) & 1;
+			if(child[k][b] < 0){
+				child[k][b] = parent.size();
+				parent.push_back(k);
+				bit.push_back(b);
+				depth.push_back(i);
+				child.push_back(std::array<int32_t, 2>{{-1, -1}});
+			}
+			k = child[k][b];
+			path[i] = k;
+		}
+	}
+	uint32_t size() const { return parent.size(); }
+};
+
+/**
+ * prefix[k] = sum of 3 (x_j XOR y_j) over the bits y_j of the prefix of trie node k,
+ * computed once per trie edge instead of once per decision node and bit
+ */
+inline void trieXorPrefixes(const Elgamal::PublicKey& pub, const ThresholdTrie& trie, const std::vector<Elgamal::CipherText>& xenc,
+		std::vector<Elgamal::CipherText>& prefix, AesCtrDrbg& rng){
+	prefix.resize(trie.size());
+	for(uint32_t k = 1; k < trie.size(); ++k){
+		const uint32_t i = trie.depth[k] - 1;
+		prefix[k] = xorWithConst(pub, xenc[i], trie.bit[k], rng); //y_i + x_i
+		prefix[k].mul(3); //*3
+		if(trie.parent[k] != 0){
+			prefix[k].add(prefix[trie.parent[k]]);
+		}
+	}
+	Elgamal::CipherText::batchNormalize(prefix); //every prefix is added to many results, as mixed additions
+}
+
+/**
+ * PvtCmpS on W bits with the xor sums taken from the trie: result_i = x_i - y_i + s + tmpsum + (prefix_i for i > 0),
+ * which decrypts to the result of PvtCmpS for the same tmpsum, an encryption of 0. tmpsum rerandomizes result_0
+ * too, otherwise it is the client's own ciphertext of x_0 shifted by a constant and recognizable after the shuffle.
+ * The encryptions of nonzero values in padding are shuffled in with the W results.
+ */
+template<uint32_t W>
+inline std::vector<Elgamal::CipherText> PvtCmpSTrie(const Elgamal::PublicKey& pub, const Elgamal::CipherText& tmpsum, const std::vector<Elgamal::CipherText>& xenc,
+		const std::vector<Elgamal::CipherText>& prefix, const std::vector<uint32_t>& path, uint64_t threshold, int server_bit,
+		const std::vector<Elgamal::CipherText>& padding, AesCtrDrbg& rng){
+	std::vector<Elgamal::CipherText> result(W + padding.size());
+	int32_t s = 1-2*server_bit; //BINDER
+
+	for(uint32_t i = 0; i < W; ++i){
+		const int y = (threshold >> (W - i - 1)) & 1;
+		result[i] = xenc[i];
+		pub.add(result[i], s - y); // x_i - y_i + s (latter two values known to server)
+	}
+	Elgamal::CipherText::batchAdd(&result[0], W, tmpsum);
+	for(uint32_t i = 1; i < W; ++i){
+		result[i].add(prefix[path[i]]);
+	}
+	std::copy(padding.begin(), padding.end(), result.begin() + W);
+	std::shuffle(result.begin(), result.end(), rng);
+	return result;
+}
+
+//PvtCmpSTrie on bits = 8, 16, 32 or 64 bits
+inline std::vector<Elgamal::CipherText> PvtCmpSBits(uint32_t bits, const Elgamal::PublicKey& pub, const Elgamal::CipherText& tmpsum, const std::vector<Elgamal::CipherText>& xenc,
+		const std::vector<Elgamal::CipherText>& prefix, const std::vector<uint32_t>& path, uint64_t threshold, int server_bit,
+		const std::vector<Elgamal::CipherText>& padding, AesCtrDrbg& rng){
+	switch(bits){
+	case 8: return PvtCmpSTrie<8>(pub, tmpsum, xenc, prefix, path, threshold, server_bit, padding, rng);
+	case 16: return PvtCmpSTrie<16>(pub, tmpsum, xenc, prefix, path, threshold, server_bit, padding, rng);
+	case 32: return PvtCmpSTrie<32>(pub, tmpsum, xenc, prefix, path, threshold, server_bit, padding, rng);
+	default: return PvtCmpSTrie<64>(pub, tmpsum, xenc, prefix, path, threshold, server_bit, padding, rng);
+	}
+}
+
+#endif // PVT_CMP_H_INCLUDED
@@ -0,0 +1,186 @@
+/**
+ \file 		self_check.cpp
+ \author 	kiss@encrypto.cs.tu-darmstadt.de
+ \copyright	Self-check
+			Copyright (C) 2019 Cryptography and Privacy Engineering Group, TU Darmstadt
+			This program is free software: you can redistribute it and/or modify
+			it under the terms of the GNU Affero General Public License as published
+			by the Free Software Foundation, either version 3 of the License, or
+			(at your option) any later version.
+			This program is distributed in the hope that it will be useful,
+			but WITHOUT ANY WARRANTY; without even the implied warranty of
+			MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+			GNU Affero General Public License for more details.
+			You should have received a copy of the GNU Affero General Public License
+			along with this program. If not, see <http://www.gnu.org/licenses/>.
+ \brief		Checks the building blocks of HHH on random inputs: fixed and compressed ciphertext frames
+			decode to the ciphertexts they were encoded from, the zero point included, and the trie
+			comparison PvtCmpSTrie decrypts to the results of PvtCmpS on 8, 16, 32 and 64 bits, and the
+			AVX-512 IFMA and AVX2 lanes of batchAdd and batchMul (see ec_lanes.hpp) compute the points mcl
+			computes.
+			Prints one line per check and exits with 1 if one fails.
+ */
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include "curve.hpp"
+#include "drbg.hpp"
+#include "frames.hpp"
+#include "pvt_cmp.hpp"
+#include "ec_lanes.hpp"
+
+using namespace std;
+
+const uint32_t num_inputs = 20; //random inputs per comparison width
+
+AesCtrDrbg rg;
+
+bool report(const string& name, bool ok){
+	cout << name << ": " << (ok ? "ok" : "FAILED") << endl;
+	return ok;
+}
+
+//encodes ctxts into a frame and decodes it again
+bool checkFrames(const Elgamal::PublicKey& pub, bool compressed){
+	vector<Elgamal::CipherText> ctxts(8);
+	ctxts[0].c1.clear(); //zero point in both and in one component
+	ctxts[0].c2.clear();
+	pub.enc(ctxts[1], 0, rg);
+	ctxts[1].c1.clear();
+	for(size_t i = 2; i < ctxts.size(); i++){
+		pub.enc(ctxts[i], (int)i - 4, rg);
+	}
+	ctxts.back().add(ctxts[2]); //not normalized
+
+	vector<char> buf;
+	encode_frame(buf, ctxts, frame_tag, compressed);
+	const size_t ctxt_len = frame_ctxt_len(compressed);
+	bool ok = buf.size() == frame_header_len + ctxts.size() * ctxt_len && buf[0] == frame_tag
+		&& get_uint32(&buf[1]) == ctxts.size() && get_uint32(&buf[5]) == ctxt_len;
+	vector<Elgamal::CipherText> decoded;
+	decode_ctxts(buf.data(), decoded);
+	ok = ok && decoded.size() == ctxts.size();
+	for(size_t i = 0; ok && i < ctxts.size(); i++){
+		ok = decoded[i].c1 == ctxts[i].c1 && decoded[i].c2 == ctxts[i].c2;
+	}
+	return report(compressed ? "compressed frames" : "fixed frames", ok);
+}
+
+//encryptions of the bits lowest bits of x, most significant first
+vector<Elgamal::CipherText> encBits(const Elgamal::PublicKey& pub, uint64_t x, uint32_t bits){
+	vector<Elgamal::CipherText> xenc(bits);
+	for(uint32_t i = 0; i < bits; i++){
+		pub.enc(xenc[i], (int)((x >> (bits - i - 1)) & 1), rg);
+	}
+	return xenc;
+}
+
+vector<int> decAll(const Elgamal::PrivateKey& prv, const vector<Elgamal::CipherText>& ctxts, const Elgamal::Bsgs& bsgs, bool& ok){
+	vector<int> values(ctxts.size());
+	for(size_t i = 0; i < ctxts.size(); i++){
+		bool found;
+		values[i] = prv.dec(ctxts[i], bsgs, &found);
+		ok = ok && found;
+	}
+	std::sort(values.begin(), values.end());
+	return values;
+}
+
+/**
+ * PvtCmpSTrie on bits against PvtCmpS on bitlen bits, the input and the threshold zero-extended: the results
+ * of the extra leading bits are s, the others must be the same. The comparison is also checked against
+ * the plain one, a result 0 means x < y for server bit 0 and x > y for server bit 1.
+ */
+bool checkComparison(const Elgamal::PrivateKey& prv, const Elgamal::Bsgs& bsgs, uint32_t bits){
+	const Elgamal::PublicKey& pub = prv.getPublicKey();
+	const uint64_t mask = bits == 64 ? ~0ULL : (1ULL << bits) - 1;
+	bool ok = true;
+	for(uint32_t t = 0; ok && t < num_inputs; t++){
+		const uint64_t x = rg.get64() & mask;
+		const uint64_t y = t % 4 == 0 ? x : t % 4 == 1 ? (x ^ 1) : rg.get64() & mask; //equal and neighbouring inputs too
+		const int server_bit = rg.get32() & 1;
+
+		const vector<Elgamal::CipherText> xenc = encBits(pub, x, bits);
+		ThresholdTrie trie;
+		vector<uint32_t> path;
+		trie.insert(y, bits, path);
+		vector<Elgamal::CipherText> prefix;
+		trieXorPrefixes(pub, trie, xenc, prefix, rg);
+		Elgamal::CipherText tmpsum;
+		pub.enc(tmpsum, 0, rg);
+		const vector<int> trie_values = decAll(prv, PvtCmpSBits(bits, pub, tmpsum, xenc, prefix, path, y, server_bit,
+			vector<Elgamal::CipherText>(), rg), bsgs, ok);
+
+		vector<int> plain_values = decAll(prv, PvtCmpS(pub, tmpsum, encBits(pub, x, bitlen), y, server_bit, rg), bsgs, ok);
+		const int s = 1 - 2 * server_bit;
+		for(uint32_t i = bits; i < bitlen; i++){
+			plain_values.erase(std::find(plain_values.begin(), plain_values.end(), s));
+		}
+		const bool zero = std::count(trie_values.begin(), trie_values.end(), 0) == 1;
+		ok = ok && trie_values == plain_values && zero == (server_bit == 0 ? x < y : x > y);
+	}
+	return report("PvtCmpSTrie on " + std::to_string(bits) + " bits", ok);
+}
+
+/**
+ * batchAdd and batchMul with the lanes of isa against one by one without them, on as many ciphertexts as
+ * leave lanes of the last eight unused, zero points, unnormalized points and scalars 0 and 1 included
+ */
+bool checkLanes(const Elgamal::PublicKey& pub, EcLanes<Elgamal>::Isa isa, const std::string& name){
+	const Elgamal::CipherText::LaneBackend none = {0, 0};
+	if(EcLanes<Elgamal>::init(isa) != isa){
+		Elgamal::CipherText::setLaneBackend(none);
+		cout << "lanes (" << name << "): skipped, not supported" << endl;
+		return true;
+	}
+	vector<Elgamal::CipherText> ctxts(11);
+	vector<uint64_t> x(ctxts.size());
+	for(size_t i = 0; i < ctxts.size(); i++){
+		pub.enc(ctxts[i], (int)i, rg);
+		x[i] = rg.get64();
+	}
+	ctxts[0].c1.clear();
+	ctxts[1].c2.clear();
+	ctxts[2].add(ctxts[3]);
+	x[3] = 0;
+	x[4] = 1;
+	x[5] = ~0ULL;
+	Elgamal::CipherText t;
+	pub.enc(t, 7, rg);
+	vector<Elgamal::CipherText> sum = ctxts;
+	sum[6] = t; //doubles
+	sum[7] = t;
+	sum[7].neg(); //adds to zero
+	vector<Elgamal::CipherText> prod = ctxts, sum_mcl = sum, prod_mcl = prod;
+
+	Elgamal::CipherText::batchAdd(sum.data(), sum.size(), t);
+	Elgamal::CipherText::batchMul(prod.data(), prod.size(), x.data());
+	Elgamal::CipherText::setLaneBackend(none);
+	Elgamal::CipherText::batchAdd(sum_mcl.data(), sum_mcl.size(), t);
+	Elgamal::CipherText::batchMul(prod_mcl.data(), prod_mcl.size(), x.data());
+	bool ok = true;
+	for(size_t i = 0; i < ctxts.size(); i++){
+		ok = ok && sum[i].c1 == sum_mcl[i].c1 && sum[i].c2 == sum_mcl[i].c2
+			&& prod[i].c1 == prod_mcl[i].c1 && prod[i].c2 == prod_mcl[i].c2;
+	}
+	return report("lanes (" + name + ")", ok);
+}
+
+int main(int argc, char *argv[]) {
+	HHHGroup::init();
+	Elgamal::PrivateKey prv;
+	prv.init(HHHGroup::generator(), HHHGroup::bitSize(), rg);
+	Elgamal::Bsgs bsgs; //every comparison result is in [-2, 3 bitlen + 2]
+	bsgs.init(prv.getPublicKey().getF(), -2, 3 * bitlen + 2);
+
+	bool ok = checkFrames(prv.getPublicKey(), false);
+	ok = checkFrames(prv.getPublicKey(), true) && ok;
+	const uint32_t widths[4] = {8, 16, 32, 64};
+	for(int i = 0; i < 4; i++){
+		ok = checkComparison(prv, bsgs, widths[i]) && ok;
+	}
+	ok = checkLanes(prv.getPublicKey(), EcLanes<Elgamal>::avx512ifma, "AVX-512 IFMA") && ok;
+	ok = checkLanes(prv.getPublicKey(), EcLanes<Elgamal>::avx2, "AVX2") && ok;
+	return ok ? 0 : 1;
+}
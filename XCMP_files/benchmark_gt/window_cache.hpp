@@ -0,0 +1,439 @@
+/**
+ \file 		window_cache.hpp
+ \author 	kiss@encrypto.cs.tu-darmstadt.de
+ \copyright	Window table cache
+			Copyright (C) 2019 Cryptography and Privacy Engineering Group, TU Darmstadt
+			This program is free software: you can redistribute it and/or modify
+			it under the terms of the GNU Affero General Public License as published
+			by the Free Software Foundation, either version 3 of the License, or
+			(at your option) any later version.
+			This program is distributed in the hope that it will be useful,
+			but WITHOUT ANY WARRANTY; without even the implied warranty of
+			MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+			GNU Affero General Public License for more details.
+			You should have received a copy of the GNU Affero General Public License
+			along with this program. If not, see <http://www.gnu.org/licenses/>.
+ \brief		On-disk cache of the fixed-base window tables (f, g, h) of ElGamal public keys, one
+			file per public key and window size. Files are mapped read-only and shared by all
+			sessions of a process and by all processes on the machine, so a known key is
+			loaded without building its tables. Tables are only written for keys seen before, by any
+			process, which an empty marker file records, so keys used once (e.g. per-run client keys)
+			cost no table file. The mappings of the least recently used keys
+			are dropped beyond max_keys and unmapped once no key attached to them is left,
+			the least recently used files are removed beyond max_files.
+			The directory and its files are owner-only, files of other users or writable by them
+			are not mapped, and every table is checked against a checksum in the file header.
+ */
+
+#ifndef WINDOW_CACHE_H_INCLUDED
+#define WINDOW_CACHE_H_INCLUDED
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <list>
+#include <memory>
+#include <algorithm>
+#include <mutex>
+#include <time.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include "offline_store.hpp"
+
+/*
+	file layout
+	WindowCacheHeader | public key string (pub_len bytes) | padding up to table_offset | tables of f, g and h
+	every table holds fp_num raw Fp elements as laid out by ElgamalT::WindowTable
+*/
+struct WindowCacheHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t win_size;
+	uint32_t bit_size;
+	uint32_t fp_size; //sizeof(Fp) of the build that wrote the file
+	uint64_t fp_num; //Fp elements per table
+	uint64_t key_hash;
+	uint64_t pub_len;
+	uint64_t table_offset; //multiple of the page size
+	uint64_t table_sum; //checksum of the tables, see window_table_sum
+};
+
+const char window_cache_magic[8] = {'H', 'H', 'H', 'W', 'I', 'N', 'D', 'W'};
+const uint32_t window_cache_version = 2;
+
+//FNV-1a over the 64-bit words of the tables, detects truncated or altered files, h continues a sum
+inline uint64_t window_table_sum(const char* tables, size_t len, uint64_t h = 14695981039346656037ULL){
+	for(size_t i = 0; i + 8 <= len; i += 8){
+		uint64_t w;
+		memcpy(&w, tables + i, 8);
+		h ^= w;
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+template<class Elgamal>
+class WindowCache {
+  public:
+	typedef typename Elgamal::PublicKey PublicKey;
+	typedef typename Elgamal::Ec Ec;
+	typedef typename Ec::Fp Fp;
+
+	/**
+	 * @param dir directory of the cache files
+	 * @param win_size window size of the tables, 2^win_size - 1 points per win_size scalar bits
+	 * @param max_keys number of keys (at least 1) whose mappings the cache keeps, keys still attached to a
+	 * dropped mapping keep it until they are destroyed
+	 * @param max_files number of table files kept in dir
+	 */
+	WindowCache(const std::string& dir, size_t win_size, size_t max_keys, size_t max_files);
+
+	//makes dir owner-only, false if it is not a directory of this user
+	static bool prepareDir(const std::string& dir);
+
+	static std::string path(const std::string& dir, const std::string& pub_str, size_t win_size);
+
+	/**
+	 * Attaches the mapped tables of pub. The cache file of an unknown key is mapped, or written first if
+	 * it does not exist yet and the key was seen before, and the mapping of the least recently used key
+	 * is dropped if max_keys are mapped. Returns false if pub is left without tables, e.g. for a key seen
+	 * for the first time, whose marker file is created instead.
+	 */
+	bool provide(PublicKey& pub);
+
+	size_t keys();
+	//bytes of all mapped tables
+	size_t memoryByteSize();
+	//keys served from a mapping or an existing file
+	uint64_t hits();
+	//keys whose tables were built
+	uint64_t builds();
+
+  private:
+	//a mapped file, unmapped when the cache and all keys attached to it have released it
+	struct Mapping {
+		char* base;
+		size_t len;
+		Mapping(char* base, size_t len) : base(base), len(len) {}
+		~Mapping(){ munmap(base, len); }
+	  private:
+		Mapping(const Mapping&);
+		Mapping& operator=(const Mapping&);
+	};
+	typedef std::shared_ptr<const Mapping> MappingPtr;
+	struct Slot {
+		MappingPtr mapping;
+		std::list<std::string>::iterator lru;
+	};
+
+	MappingPtr map(const std::string& file, const std::string& pub_str, const PublicKey& pub);
+	bool seenBefore(const std::string& file);
+	bool write(const std::string& file, const std::string& pub_str, const PublicKey& pub);
+	void attach(PublicKey& pub, const MappingPtr& m);
+	void collectFiles();
+	static void removeOldest(std::vector< std::pair<time_t, std::string> >& files, size_t keep);
+
+	static const size_t max_seen_factor = 16; //markers are empty files, far more of them are kept than table files
+
+	const std::string dir;
+	const size_t win_size;
+	const size_t max_keys;
+	const size_t max_files;
+	//keys hold pointers into the mappings and share their ownership, see ElgamalT::WindowTable::attach
+	std::map<std::string, Slot> mappings;
+	std::list<std::string> lru; //key strings of the mappings, most recently used first
+	uint64_t num_hits;
+	uint64_t num_builds;
+	std::mutex mtx;
+};
+
+template<class Elgamal>
+WindowCache<Elgamal>::WindowCache(const std::string& dir, size_t win_size, size_t max_keys, size_t max_files)
+  : dir(dir)
+  , win_size(win_size)
+  , max_keys(std::max(max_keys, (size_t)1))
+  , max_files(max_files)
+  , num_hits(0)
+  , num_builds(0)
+{
+}
+
+template<class Elgamal>
+bool WindowCache<Elgamal>::prepareDir(const std::string& dir){
+	return prepare_private_dir(dir);
+}
+
+template<class Elgamal>
+std::string WindowCache<Elgamal>::path(const std::string& dir, const std::string& pub_str, size_t win_size){
+	char name[64];
+	snprintf(name, sizeof(name), "/hhh_window_%016llx_%u.tbl", (unsigned long long)hash_str(pub_str), (unsigned)win_size);
+	return dir + name;
+}
+
+template<class Elgamal>
+bool WindowCache<Elgamal>::provide(PublicKey& pub){
+	const std::string pub_str = pub.getStr(); //the tables are not part of the key string
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		typename std::map<std::string, Slot>::iterator it = mappings.find(pub_str);
+		if(it != mappings.end()){
+			lru.splice(lru.begin(), lru, it->second.lru);
+			attach(pub, it->second.mapping);
+			num_hits++;
+			return true;
+		}
+	}
+	//mapping or building a new file is done without the lock
+	const std::string file = path(dir, pub_str, win_size);
+	MappingPtr m = map(file, pub_str, pub);
+	const bool cached = m != 0;
+	if(cached){
+		utimes(file.c_str(), 0); //the modification time orders the files for collectFiles
+	}
+	else if(!seenBefore(file)){
+		collectFiles();
+		return false;
+	}
+	else{
+		pub.enableWindowMethod(win_size);
+		const bool written = write(file, pub_str, pub);
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			num_builds++;
+		}
+		if(!written){
+			return true; //pub keeps the tables it has built
+		}
+		collectFiles();
+		m = map(file, pub_str, pub);
+		if(!m){
+			return true;
+		}
+	}
+	std::lock_guard<std::mutex> lock(mtx);
+	num_hits += cached;
+	typename std::map<std::string, Slot>::iterator it = mappings.find(pub_str);
+	if(it != mappings.end()){ //mapped by another session in the meantime, m is unmapped on return
+		lru.splice(lru.begin(), lru, it->second.lru);
+		m = it->second.mapping;
+	}
+	else{
+		while(mappings.size() >= max_keys){ //keys attached to the dropped mapping keep it
+			mappings.erase(lru.back());
+			lru.pop_back();
+		}
+		lru.push_front(pub_str);
+		Slot& slot = mappings[pub_str];
+		slot.mapping = m;
+		slot.lru = lru.begin();
+	}
+	attach(pub, m);
+	return true;
+}
+
+template<class Elgamal>
+size_t WindowCache<Elgamal>::keys(){
+	std::lock_guard<std::mutex> lock(mtx);
+	return mappings.size();
+}
+
+template<class Elgamal>
+size_t WindowCache<Elgamal>::memoryByteSize(){
+	std::lock_guard<std::mutex> lock(mtx);
+	size_t bytes = 0;
+	for(typename std::map<std::string, Slot>::iterator it = mappings.begin(); it != mappings.end(); ++it){
+		const WindowCacheHeader& h = *(const WindowCacheHeader*)it->second.mapping->base;
+		bytes += 3 * h.fp_num * h.fp_size;
+	}
+	return bytes;
+}
+
+template<class Elgamal>
+uint64_t WindowCache<Elgamal>::hits(){
+	std::lock_guard<std::mutex> lock(mtx);
+	return num_hits;
+}
+
+template<class Elgamal>
+uint64_t WindowCache<Elgamal>::builds(){
+	std::lock_guard<std::mutex> lock(mtx);
+	return num_builds;
+}
+
+/**
+ * Maps file read-only and checks that it holds the tables of pub for this build: owner and mode, header,
+ * key string, the checksum of the tables and, as a check of the Fp representation, the first point of the
+ * table of f, which is f itself
+ */
+template<class Elgamal>
+typename WindowCache<Elgamal>::MappingPtr WindowCache<Elgamal>::map(const std::string& file, const std::string& pub_str, const PublicKey& pub){
+	const int fd = ::open(file.c_str(), O_RDONLY);
+	if(fd < 0){
+		return MappingPtr();
+	}
+	struct stat st;
+	if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(WindowCacheHeader)
+		|| st.st_uid != geteuid() || (st.st_mode & (S_IWGRP | S_IWOTH)) != 0){
+		::close(fd);
+		return MappingPtr();
+	}
+	void* p = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);
+	if(p == MAP_FAILED){
+		return MappingPtr();
+	}
+	MappingPtr m = std::make_shared<const Mapping>((char*)p, st.st_size);
+	const WindowCacheHeader& h = *(const WindowCacheHeader*)m->base;
+	const uint64_t fp_num = Elgamal::WindowTable::getFpNum(pub.getBitSize(), win_size);
+	bool ok = memcmp(h.magic, window_cache_magic, sizeof(window_cache_magic)) == 0 && h.version == window_cache_version
+		&& h.win_size == win_size && h.bit_size == pub.getBitSize() && h.fp_size == sizeof(Fp) && h.fp_num == fp_num
+		&& h.pub_len == pub_str.size() && h.table_offset >= sizeof(h) + h.pub_len
+		&& m->len == h.table_offset + 3 * fp_num * sizeof(Fp)
+		&& memcmp(m->base + sizeof(h), pub_str.data(), pub_str.size()) == 0
+		&& window_table_sum(m->base + h.table_offset, 3 * fp_num * sizeof(Fp)) == h.table_sum;
+	if(ok){
+		Ec f(pub.getF());
+		f.normalize();
+		const Fp* tbl_f = (const Fp*)(m->base + h.table_offset);
+		ok = tbl_f[0] == f.x && tbl_f[1] == f.y;
+	}
+	return ok ? m : MappingPtr();
+}
+
+/**
+ * True if the marker of the table file was there already, otherwise creates it. The marker is removed once
+ * the table file is written.
+ */
+template<class Elgamal>
+bool WindowCache<Elgamal>::seenBefore(const std::string& file){
+	const std::string marker = file + ".seen";
+	struct stat st;
+	if(stat(marker.c_str(), &st) == 0){
+		return st.st_uid == geteuid();
+	}
+	const int fd = ::open(marker.c_str(), O_WRONLY | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+	if(fd >= 0){
+		::close(fd);
+	}
+	return false;
+}
+
+//atomically writes the tables pub has built, see map for the checks on reading
+template<class Elgamal>
+bool WindowCache<Elgamal>::write(const std::string& file, const std::string& pub_str, const PublicKey& pub){
+	WindowCacheHeader h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, window_cache_magic, sizeof(window_cache_magic));
+	h.version = window_cache_version;
+	h.win_size = win_size;
+	h.bit_size = pub.getBitSize();
+	h.fp_size = sizeof(Fp);
+	h.fp_num = Elgamal::WindowTable::getFpNum(pub.getBitSize(), win_size);
+	h.key_hash = hash_str(pub_str);
+	h.pub_len = pub_str.size();
+	const size_t page = sysconf(_SC_PAGESIZE);
+	h.table_offset = (sizeof(h) + h.pub_len + page - 1) / page * page;
+	const Fp* tables[3] = {pub.getWindowTableF().getTable(), pub.getWindowTableG().getTable(), pub.getWindowTableH().getTable()};
+	if(!tables[0] || !tables[1] || !tables[2]){
+		return false;
+	}
+	h.table_sum = window_table_sum((const char*)tables[0], h.fp_num * sizeof(Fp)); //the tables as laid out in the file
+	h.table_sum = window_table_sum((const char*)tables[1], h.fp_num * sizeof(Fp), h.table_sum);
+	h.table_sum = window_table_sum((const char*)tables[2], h.fp_num * sizeof(Fp), h.table_sum);
+
+	std::vector<char> head(h.table_offset, 0);
+	memcpy(&head[0], &h, sizeof(h));
+	memcpy(&head[sizeof(h)], pub_str.data(), pub_str.size());
+	const std::string tmp = file + "." + std::to_string(getpid()) + ".tmp";
+	const int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+	if(fd < 0){
+		return false;
+	}
+	FILE* fp = fdopen(fd, "wb");
+	if(!fp){
+		::close(fd);
+		unlink(tmp.c_str());
+		return false;
+	}
+	bool ok = fwrite(head.data(), 1, head.size(), fp) == head.size();
+	for(int i = 0; i < 3; i++){
+		ok = ok && fwrite(tables[i], sizeof(Fp), h.fp_num, fp) == h.fp_num;
+	}
+	ok = fflush(fp) == 0 && fsync(fileno(fp)) == 0 && ok;
+	fclose(fp);
+	ok = ok && rename(tmp.c_str(), file.c_str()) == 0;
+	if(!ok){
+		unlink(tmp.c_str());
+	}
+	else{
+		unlink((file + ".seen").c_str());
+	}
+	return ok;
+}
+
+template<class Elgamal>
+void WindowCache<Elgamal>::attach(PublicKey& pub, const MappingPtr& m){
+	const WindowCacheHeader& h = *(const WindowCacheHeader*)m->base;
+	const Fp* tbl = (const Fp*)(m->base + h.table_offset);
+	pub.attachWindowTables(tbl, tbl + h.fp_num, tbl + 2 * h.fp_num, win_size, m);
+}
+
+/**
+ * Removes the table files beyond max_files with the oldest modification time, i.e. the least recently
+ * mapped ones, the oldest markers beyond max_seen_factor max_files and temporary files left by writers
+ * that died. Processes that have mapped a removed file keep their mapping.
+ */
+template<class Elgamal>
+void WindowCache<Elgamal>::collectFiles(){
+	DIR* d = opendir(dir.c_str());
+	if(!d){
+		return;
+	}
+	std::vector< std::pair<time_t, std::string> > files, markers;
+	const time_t now = time(0);
+	while(struct dirent* e = readdir(d)){
+		const std::string name = e->d_name;
+		if(name.compare(0, 11, "hhh_window_") != 0){
+			continue;
+		}
+		const std::string file = dir + "/" + name;
+		struct stat st;
+		if(stat(file.c_str(), &st) != 0 || !S_ISREG(st.st_mode)){
+			continue;
+		}
+		if(name.size() > 4 && name.compare(name.size() - 4, 4, ".tmp") == 0){
+			if(now - st.st_mtime > 3600){
+				unlink(file.c_str());
+			}
+		}
+		else if(name.size() > 4 && name.compare(name.size() - 4, 4, ".tbl") == 0){
+			files.push_back(std::make_pair(st.st_mtime, file));
+		}
+		else if(name.size() > 5 && name.compare(name.size() - 5, 5, ".seen") == 0){
+			markers.push_back(std::make_pair(st.st_mtime, file));
+		}
+	}
+	closedir(d);
+	removeOldest(files, max_files);
+	removeOldest(markers, max_seen_factor * max_files);
+}
+
+template<class Elgamal>
+void WindowCache<Elgamal>::removeOldest(std::vector< std::pair<time_t, std::string> >& files, size_t keep){
+	if(files.size() <= keep){
+		return;
+	}
+	std::sort(files.begin(), files.end());
+	for(size_t i = 0; i < files.size() - keep; i++){
+		unlink(files[i].second.c_str());
+	}
+}
+
+#endif // WINDOW_CACHE_H_INCLUDED
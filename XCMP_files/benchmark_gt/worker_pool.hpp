@@ -0,0 +1,121 @@
+/**
+ \file 		worker_pool.hpp
+ \author 	kiss@encrypto.cs.tu-darmstadt.de
+ \copyright	Worker pool
+			Copyright (C) 2019 Cryptography and Privacy Engineering Group, TU Darmstadt
+			This program is free software: you can redistribute it and/or modify
+			it under the terms of the GNU Affero General Public License as published
+			by the Free Software Foundation, either version 3 of the License, or
+			(at your option) any later version.
+			This program is distributed in the hope that it will be useful,
+			but WITHOUT ANY WARRANTY; without even the implied warranty of
+			MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+			GNU Affero General Public License for more details.
+			You should have received a copy of the GNU Affero General Public License
+			along with this program. If not, see <http://www.gnu.org/licenses/>.
+ \brief		Fixed-size pool of worker threads. Every task is handed the index of the worker
+			that runs it, so callers can keep per-worker state (e.g. random generators).
+ */
+
+#ifndef WORKER_POOL_H_INCLUDED
+#define WORKER_POOL_H_INCLUDED
+
+#include <stdint.h>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+class WorkerPool {
+  public:
+	typedef std::function<void(uint32_t)> Task;
+
+	explicit WorkerPool(uint32_t num_threads);
+	~WorkerPool();
+
+	uint32_t size() const { return workers.size(); }
+	void submit(const Task& task);
+
+  private:
+	void work(uint32_t worker);
+
+	std::vector<std::thread> workers;
+	std::deque<Task> tasks;
+	std::mutex mtx;
+	std::condition_variable cv;
+	bool stopping;
+};
+
+/**
+ * Tracks completion of n jobs so that results can be consumed in job order
+ * while they are produced out of order.
+ */
+class OrderedCompletion {
+  public:
+	explicit OrderedCompletion(uint32_t n) : done(n, false) {}
+
+	void finish(uint32_t i){
+		std::lock_guard<std::mutex> lock(mtx);
+		done[i] = true;
+		cv.notify_all();
+	}
+	void wait(uint32_t i){
+		std::unique_lock<std::mutex> lock(mtx);
+		cv.wait(lock, [&]{ return done[i]; });
+	}
+
+  private:
+	std::vector<bool> done;
+	std::mutex mtx;
+	std::condition_variable cv;
+};
+
+inline WorkerPool::WorkerPool(uint32_t num_threads)
+  : stopping(false)
+{
+	if(num_threads == 0){
+		num_threads = 1;
+	}
+	for(uint32_t i = 0; i < num_threads; ++i){
+		workers.push_back(std::thread(&WorkerPool::work, this, i));
+	}
+}
+
+inline WorkerPool::~WorkerPool(){
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		stopping = true;
+	}
+	cv.notify_all();
+	for(uint32_t i = 0; i < workers.size(); ++i){
+		workers[i].join();
+	}
+}
+
+inline void WorkerPool::submit(const Task& task){
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		tasks.push_back(task);
+	}
+	cv.notify_one();
+}
+
+inline void WorkerPool::work(uint32_t worker){
+	for(;;){
+		Task task;
+		{
+			std::unique_lock<std::mutex> lock(mtx);
+			cv.wait(lock, [this]{ return stopping || !tasks.empty(); });
+			if(tasks.empty()){
+				return; //stopping and drained
+			}
+			task = tasks.front();
+			tasks.pop_front();
+		}
+		task(worker);
+	}
+}
+
+#endif // WORKER_POOL_H_INCLUDED
@@ -13,6 +13,11 @@
 */
 #include <string>
 #include <sstream>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <memory>
+#include <string.h>
 #include <cybozu/unordered_map.hpp>
 #ifndef CYBOZU_UNORDERED_MAP_STD
 #include <map>
@@ -20,13 +25,136 @@
 #include <cybozu/exception.hpp>
 #include <cybozu/itoa.hpp>
 #include <cybozu/atoi.hpp>
-#include <mcl/window_method.hpp>
+#include <mcl/gmp_util.hpp>
 
 namespace mcl {
 
 template<class _Ec, class Zn>
 struct ElgamalT {
 	typedef _Ec Ec;
+	/*
+		normalize *P[0], ..., *P[n - 1] with one inversion (Montgomery's trick)
+		zero points and points already normalized are left as they are
+	*/
+	static void normalizePoints(Ec *const *P, size_t n)
+	{
+		typedef typename Ec::Fp Fp;
+		std::vector<Ec*> v;
+		v.reserve(n);
+		for (size_t i = 0; i < n; i++) {
+			if (!P[i]->isNormalized()) v.push_back(P[i]);
+		}
+		if (v.empty()) return;
+		/* prod[i] = z_0 ... z_i */
+		std::vector<Fp> prod(v.size());
+		prod[0] = v[0]->z;
+		for (size_t i = 1; i < v.size(); i++) {
+			Fp::mul(prod[i], prod[i - 1], v[i]->z);
+		}
+		Fp inv, zi, zi2;
+		Fp::inv(inv, prod.back());
+		for (size_t i = v.size(); i > 0; i--) {
+			/* inv = 1 / (z_0 ... z_(i-1)) */
+			if (i > 1) {
+				Fp::mul(zi, inv, prod[i - 2]);
+				Fp::mul(inv, inv, v[i - 1]->z);
+			} else {
+				zi = inv;
+			}
+			Ec& Q = *v[i - 1];
+			if (Ec::mode_ == ec::Jacobi) {
+				Fp::sqr(zi2, zi);
+				Fp::mul(Q.x, Q.x, zi2);
+				Fp::mul(Q.y, Q.y, zi2);
+				Fp::mul(Q.y, Q.y, zi);
+			} else {
+				Fp::mul(Q.x, Q.x, zi);
+				Fp::mul(Q.y, Q.y, zi);
+			}
+			Q.z = 1;
+		}
+	}
+	/*
+		width of the digits of recodeRegular
+	*/
+	enum { ctWidth = 4 };
+	static size_t getRegularDigitNum(size_t bitSize) { return (bitSize + ctWidth) / ctWidth + 1; }
+	/*
+		regular signed window recoding of a secret scalar k for mulRegular, least significant digit first
+		k is reduced mod n and made odd by adding n if it is even, so P^k is unchanged for P of order n
+		every digit is odd with |digit| < 2^ctWidth and the last one is positive, there are
+		getRegularDigitNum(bitSize of n) of them whatever k is
+		the recoding itself is not constant time, it is done once per key
+	*/
+	static void recodeRegular(std::vector<int8_t>& digits, const mpz_class& k, const mpz_class& n)
+	{
+		mpz_class a = k % n;
+		if (a < 0) a += n;
+		if (!gmp::testBit(a, 0)) a += n;
+		digits.resize(getRegularDigitNum(gmp::getBitSize(n)));
+		const mpz_class mask = (mpz_class(1) << (ctWidth + 1)) - 1;
+		for (size_t i = 0; i + 1 < digits.size(); i++) {
+			const mpz_class r = a & mask;
+			const int d = int(r.get_si()) - (1 << ctWidth);
+			digits[i] = int8_t(d);
+			a -= d;
+			a >>= ctWidth;
+		}
+		digits.back() = int8_t(a.get_si());
+	}
+	/*
+		dst = src if mask is all ones, dst is kept if mask is 0, without a branch on mask
+	*/
+	static void ctCopy(Ec& dst, const Ec& src, unsigned char mask)
+	{
+		unsigned char *d = reinterpret_cast<unsigned char*>(&dst);
+		const unsigned char *s = reinterpret_cast<const unsigned char*>(&src);
+		for (size_t i = 0; i < sizeof(Ec); i++) {
+			d[i] = (unsigned char)(d[i] ^ ((d[i] ^ s[i]) & mask));
+		}
+	}
+	/*
+		Q = tbl[|d| / 2]^sign(d), every entry of tbl is read and the sign applied by masks
+	*/
+	static void ctLookup(Ec& Q, const Ec *tbl, size_t tblNum, int d)
+	{
+		const uint32_t neg = uint32_t(d) >> 31;
+		const uint32_t idx = ((uint32_t(d) ^ (0u - neg)) + neg) >> 1;
+		Q = tbl[0];
+		for (size_t j = 1; j < tblNum; j++) {
+			const uint32_t x = uint32_t(j) ^ idx;
+			ctCopy(Q, tbl[j], (unsigned char)(((x | (0u - x)) >> 31) - 1));
+		}
+		Ec negQ;
+		Ec::neg(negQ, Q);
+		ctCopy(Q, negQ, (unsigned char)(0u - neg));
+	}
+	/*
+		z = P^k for the digits of recodeRegular of a secret k
+		the same doublings and additions are run and all table entries are read for every k,
+		the odd powers P, P^3, ..., P^(2^ctWidth - 1) are kept on the stack
+	*/
+	static void mulRegular(Ec& z, const Ec& P, const std::vector<int8_t>& digits)
+	{
+		const size_t tblNum = 1 << (ctWidth - 1);
+		Ec tbl[tblNum];
+		Ec P2;
+		tbl[0] = P;
+		Ec::dbl(P2, P);
+		for (size_t i = 1; i < tblNum; i++) {
+			Ec::add(tbl[i], tbl[i - 1], P2);
+		}
+		Ec t, Q;
+		ctLookup(t, tbl, tblNum, digits.back());
+		for (size_t i = digits.size() - 1; i > 0; i--) {
+			for (int b = 0; b < ctWidth; b++) {
+				Ec::dbl(t, t);
+			}
+			ctLookup(Q, tbl, tblNum, digits[i - 1]);
+			Ec::add(t, t, Q);
+		}
+		z = t;
+	}
 	struct CipherText {
 		Ec c1;
 		Ec c2;
@@ -87,6 +215,208 @@ struct ElgamalT {
 			if (sep) cybozu::writeChar(os, sep);
 			c2.save(os, ioMode);
 		}
+		/*
+			fixed-width binary encoding
+			each point is stored as a tag byte (0 : zero, 4 : affine) followed by x and y in IoSerialize form
+			buf must have getFixedByteSize() bytes
+		*/
+		static size_t getFixedByteSize()
+		{
+			return 2 * getFixedPointByteSize();
+		}
+		void saveFixed(char *buf) const
+		{
+			saveFixedPoint(buf, c1);
+			saveFixedPoint(buf + getFixedPointByteSize(), c2);
+		}
+		void loadFixed(const char *buf)
+		{
+			loadFixedPoint(c1, buf);
+			loadFixedPoint(c2, buf + getFixedPointByteSize());
+		}
+		static size_t getFixedPointByteSize()
+		{
+			return 1 + 2 * Ec::Fp::getByteSize();
+		}
+		static void saveFixedPoint(char *buf, const Ec& P)
+		{
+			const size_t n = getFixedPointByteSize();
+			if (P.isZero()) {
+				memset(buf, 0, n);
+				return;
+			}
+			Ec Q(P);
+			Q.normalize();
+			cybozu::MemoryOutputStream os(buf + 1, n - 1);
+			buf[0] = 4;
+			Q.x.save(os, IoSerialize);
+			Q.y.save(os, IoSerialize);
+		}
+		static void loadFixedPoint(Ec& P, const char *buf)
+		{
+			if (buf[0] == 0) {
+				P.clear();
+				return;
+			}
+			if (buf[0] != 4) throw cybozu::Exception("elgamal:CipherText:loadFixed:bad tag") << int(buf[0]);
+			cybozu::MemoryInputStream is(buf + 1, getFixedPointByteSize() - 1);
+			P.x.load(is, IoSerialize);
+			P.y.load(is, IoSerialize);
+			P.z = 1;
+			if (!P.isValid()) throw cybozu::Exception("elgamal:CipherText:loadFixed:not on curve");
+		}
+		/*
+			compressed binary encoding
+			each point is stored as a tag byte (0 : zero, 2 : even y, 3 : odd y) followed by x in IoSerialize form
+			buf must have getCompressedByteSize() bytes
+		*/
+		static size_t getCompressedByteSize()
+		{
+			return 2 * getCompressedPointByteSize();
+		}
+		void saveCompressed(char *buf) const
+		{
+			saveCompressedPoint(buf, c1);
+			saveCompressedPoint(buf + getCompressedPointByteSize(), c2);
+		}
+		/*
+			load c[0], ..., c[n - 1] from n consecutive compressed ciphertexts
+			y costs one square root per point, a root exists iff x is on the curve
+		*/
+		static void loadCompressed(CipherText *c, size_t n, const char *buf)
+		{
+			const size_t len = getCompressedPointByteSize();
+			for (size_t i = 0; i < n; i++) {
+				loadCompressedPoint(c[i].c1, buf + (2 * i) * len);
+				loadCompressedPoint(c[i].c2, buf + (2 * i + 1) * len);
+			}
+		}
+		static size_t getCompressedPointByteSize()
+		{
+			return 1 + Ec::Fp::getByteSize();
+		}
+		static void saveCompressedPoint(char *buf, const Ec& P)
+		{
+			const size_t n = getCompressedPointByteSize();
+			if (P.isZero()) {
+				memset(buf, 0, n);
+				return;
+			}
+			Ec Q(P);
+			Q.normalize();
+			cybozu::MemoryOutputStream os(buf + 1, n - 1);
+			buf[0] = Q.y.isOdd() ? 3 : 2;
+			Q.x.save(os, IoSerialize);
+		}
+		// y^2 = x^3 + ax + b, the root with the parity of the tag
+		static void loadCompressedPoint(Ec& P, const char *buf)
+		{
+			if (buf[0] == 0) {
+				P.clear();
+				return;
+			}
+			if (buf[0] != 2 && buf[0] != 3) throw cybozu::Exception("elgamal:CipherText:loadCompressed:bad tag") << int(buf[0]);
+			cybozu::MemoryInputStream is(buf + 1, getCompressedPointByteSize() - 1);
+			P.x.load(is, IoSerialize);
+			P.z = 1;
+			typedef typename Ec::Fp Fp;
+			Fp rhs;
+			Fp::sqr(rhs, P.x);
+			rhs += Ec::a_;
+			rhs *= P.x;
+			rhs += Ec::b_;
+			if (!Fp::squareRoot(P.y, rhs)) throw cybozu::Exception("elgamal:CipherText:loadCompressed:not on curve");
+			if (P.y.isOdd() != (buf[0] == 3)) Fp::neg(P.y, P.y);
+		}
+		/*
+			normalize c1 and c2 of c[0], ..., c[n - 1] with one inversion
+			e.g. before saveFixed or comparisons of many ciphertexts
+		*/
+		static void batchNormalize(CipherText *c, size_t n)
+		{
+			std::vector<Ec*> P(2 * n);
+			for (size_t i = 0; i < n; i++) {
+				P[2 * i] = &c[i].c1;
+				P[2 * i + 1] = &c[i].c2;
+			}
+			normalizePoints(P.data(), P.size());
+		}
+		static void batchNormalize(std::vector<CipherText>& c)
+		{
+			if (!c.empty()) batchNormalize(&c[0], c.size());
+		}
+		/*
+			point arithmetic on several points at once, e.g. in SIMD lanes, used by batchAdd and batchMul if set
+			add: *P[i] = *P[i] + Q for i in [0, n), Q normalized and not zero
+			mul: *P[i] = *P[i] x[i] for i in [0, n), every *P[i] normalized or zero
+			a function returns false if it did not touch the points, they are then processed one by one
+		*/
+		struct LaneBackend {
+			bool (*add)(Ec *const *P, size_t n, const Ec& Q);
+			bool (*mul)(Ec *const *P, size_t n, const uint64_t *x);
+		};
+		static void setLaneBackend(const LaneBackend& lanes) { laneBackend() = lanes; }
+		/*
+			c[i] = c[i] + t for i in [0, n)
+			t is normalized once, so that every addition is a mixed addition (z of t is one)
+		*/
+		static void batchAdd(CipherText *c, size_t n, const CipherText& t)
+		{
+			CipherText at(t);
+			batchNormalize(&at, 1);
+			const LaneBackend& lanes = laneBackend();
+			if (lanes.add && n > 0 && !at.c1.isZero() && !at.c2.isZero()) {
+				std::vector<Ec*> P(n);
+				for (size_t i = 0; i < n; i++) P[i] = &c[i].c1;
+				if (lanes.add(P.data(), n, at.c1)) {
+					for (size_t i = 0; i < n; i++) P[i] = &c[i].c2;
+					if (!lanes.add(P.data(), n, at.c2)) {
+						for (size_t i = 0; i < n; i++) Ec::add(c[i].c2, c[i].c2, at.c2);
+					}
+					return;
+				}
+			}
+			for (size_t i = 0; i < n; i++) {
+				c[i].add(at);
+			}
+		}
+		/*
+			c[i] = c[i] x[i] for i in [0, n)
+			the bases are normalized with one inversion first, so that every addition of a base
+			in the precomputation of the scalar multiplications is a mixed addition
+		*/
+		template<class N>
+		static void batchMul(CipherText *c, size_t n, const N *x)
+		{
+			batchNormalize(c, n);
+			if (n > 0 && mulLanes(c, n, x)) return;
+			for (size_t i = 0; i < n; i++) {
+				c[i].mul(x[i]);
+			}
+		}
+	private:
+		static LaneBackend& laneBackend()
+		{
+			static LaneBackend lanes = { 0, 0 };
+			return lanes;
+		}
+		/* the lanes take 64-bit scalars only */
+		static bool mulLanes(CipherText *c, size_t n, const uint64_t *x)
+		{
+			const LaneBackend& lanes = laneBackend();
+			if (!lanes.mul) return false;
+			std::vector<Ec*> P(2 * n);
+			std::vector<uint64_t> y(2 * n);
+			for (size_t i = 0; i < n; i++) {
+				P[2 * i] = &c[i].c1;
+				P[2 * i + 1] = &c[i].c2;
+				y[2 * i] = y[2 * i + 1] = x[i];
+			}
+			return lanes.mul(P.data(), 2 * n, y.data());
+		}
+		template<class N>
+		static bool mulLanes(CipherText *, size_t, const N *) { return false; }
+	public:
 		void getStr(std::string& str, int ioMode = 0) const
 		{
 			str.clear();
@@ -177,17 +507,236 @@ struct ElgamalT {
 		void fromStr(const std::string& str) { setStr(str); }
 	};
 
+	/*
+		fixed-base window table of P for scalars of up to bitSize bits
+		window i of winSize bits holds the affine x, y of P^(j 2^(winSize i)) for 0 < j < 2^winSize,
+		so that P^k takes one mixed addition per nonzero window of k and no doubling
+		the table is built in memory (init) or attached to memory of the caller (attach), e.g. a mapped
+		file shared by processes, which must stay unchanged while the table is used; the table and its
+		copies hold owner, which keeps the memory valid
+	*/
+	class WindowTable {
+		typedef typename Ec::Fp Fp;
+		enum { maxWordNum = 9 };
+		size_t bitSize;
+		size_t winSize;
+		std::vector<Fp> own;
+		const Fp *ext;
+		std::shared_ptr<const void> owner;
+		/*
+			|k| as little endian words and the sign of k
+		*/
+		struct Scalar {
+			uint64_t w[maxWordNum];
+			bool isNeg;
+			Scalar() : isNeg(false) { memset(w, 0, sizeof(w)); }
+		};
+		static void setScalar(Scalar& s, const Zn& x)
+		{
+			mpz_class k;
+			x.getMpz(k);
+			const size_t n = k == 0 ? 0 : std::min(gmp::getBitSize(k), size_t(64 * maxWordNum));
+			for (size_t i = 0; i < n; i++) {
+				if (gmp::testBit(k, i)) s.w[i / 64] |= uint64_t(1) << (i % 64);
+			}
+		}
+		static void setScalar(Scalar& s, uint64_t x) { s.w[0] = x; }
+		static void setScalar(Scalar& s, uint32_t x) { s.w[0] = x; }
+		static void setScalar(Scalar& s, int64_t x)
+		{
+			s.isNeg = x < 0;
+			s.w[0] = s.isNeg ? uint64_t(0) - uint64_t(x) : uint64_t(x);
+		}
+		static void setScalar(Scalar& s, int x) { setScalar(s, int64_t(x)); }
+		const Fp *data() const { return own.empty() ? ext : &own[0]; }
+		/*
+			digit of window i of s
+		*/
+		uint64_t getDigit(const Scalar& s, size_t i) const
+		{
+			const size_t pos = i * winSize;
+			uint64_t d = s.w[pos / 64] >> (pos % 64);
+			if (pos % 64 + winSize > 64 && pos / 64 + 1 < maxWordNum) {
+				d |= s.w[pos / 64 + 1] << (64 - pos % 64);
+			}
+			return d & ((uint64_t(1) << winSize) - 1);
+		}
+	public:
+		WindowTable() : bitSize(0), winSize(0), ext(0) {}
+		static size_t getWindowNum(size_t bitSize, size_t winSize) { return (bitSize + winSize - 1) / winSize; }
+		/*
+			number of Fp elements of a table, two per point
+		*/
+		static size_t getFpNum(size_t bitSize, size_t winSize)
+		{
+			return getWindowNum(bitSize, winSize) * ((size_t(1) << winSize) - 1) * 2;
+		}
+		void init(const Ec& P, size_t bitSize, size_t winSize)
+		{
+			if (winSize == 0 || winSize > 20 || bitSize > 64 * maxWordNum) throw cybozu::Exception("mcl:ElgamalT:WindowTable:bad size") << bitSize << winSize;
+			this->bitSize = bitSize;
+			this->winSize = winSize;
+			ext = 0;
+			owner.reset();
+			const size_t tblNum = (size_t(1) << winSize) - 1;
+			own.resize(getFpNum(bitSize, winSize));
+			std::vector<Ec> w(tblNum);
+			std::vector<Ec*> pw(tblNum);
+			Ec base = P;
+			for (size_t i = 0; i < getWindowNum(bitSize, winSize); i++) {
+				w[0] = base;
+				pw[0] = &w[0];
+				for (size_t j = 1; j < tblNum; j++) {
+					Ec::add(w[j], w[j - 1], base);
+					pw[j] = &w[j];
+				}
+				Ec::add(base, w[tblNum - 1], base);
+				normalizePoints(pw.data(), tblNum);
+				for (size_t j = 0; j < tblNum; j++) {
+					own[2 * (i * tblNum + j)] = w[j].x;
+					own[2 * (i * tblNum + j) + 1] = w[j].y;
+				}
+			}
+		}
+		/*
+			tbl has getFpNum(bitSize, winSize) elements laid out as by init, see data
+		*/
+		void attach(const Fp *tbl, size_t bitSize, size_t winSize, const std::shared_ptr<const void>& owner = std::shared_ptr<const void>())
+		{
+			this->bitSize = bitSize;
+			this->winSize = winSize;
+			own.clear();
+			ext = tbl;
+			this->owner = owner;
+		}
+		bool isEmpty() const { return data() == 0; }
+		size_t getWinSize() const { return winSize; }
+		/*
+			affine x, y of every point, laid out window by window
+		*/
+		const Fp *getTable() const { return data(); }
+		size_t getMemoryByteSize() const { return isEmpty() ? 0 : getFpNum(bitSize, winSize) * sizeof(Fp); }
+		template<class N>
+		void mul(Ec& z, const N& n) const
+		{
+			Scalar s;
+			setScalar(s, n);
+			const Fp *tbl = data();
+			const size_t tblNum = (size_t(1) << winSize) - 1;
+			Ec t;
+			t.z = 1;
+			z.clear();
+			for (size_t i = 0; i < getWindowNum(bitSize, winSize); i++) {
+				const uint64_t d = getDigit(s, i);
+				if (d == 0) continue;
+				const Fp *xy = tbl + 2 * (i * tblNum + d - 1);
+				t.x = xy[0];
+				t.y = xy[1];
+				Ec::add(z, z, t);
+			}
+			if (s.isNeg) Ec::neg(z, z);
+		}
+		/*
+			*z[j n + i] = P_j^k[i] for the tables tbl[0], ..., tbl[m - 1] of the points P_j and 0 <= i < n
+			the tables must have the same bitSize and winSize, e.g. those of g and h of a key
+			the digits of every scalar are extracted once, and the m n accumulators are added up in affine
+			coordinates with one inversion per window shared by all of them (Montgomery's trick),
+			which takes about 5M + 1S per addition instead of 7M + 4S of a mixed addition
+			every *z[j n + i] is normalized
+		*/
+		static void mulBatch(const WindowTable *const *tbl, size_t m, Ec *const *z, const Zn *k, size_t n)
+		{
+			if (m == 0 || n == 0) return;
+			const WindowTable& t0 = *tbl[0];
+			for (size_t j = 1; j < m; j++) {
+				if (tbl[j]->bitSize != t0.bitSize || tbl[j]->winSize != t0.winSize) throw cybozu::Exception("mcl:ElgamalT:WindowTable:mulBatch:different tables");
+			}
+			const size_t tblNum = (size_t(1) << t0.winSize) - 1;
+			std::vector<Scalar> s(n);
+			for (size_t i = 0; i < n; i++) {
+				setScalar(s[i], k[i]);
+			}
+			for (size_t i = 0; i < m * n; i++) {
+				z[i]->clear();
+			}
+			/* accumulators of the current window that take an affine addition, and their points */
+			std::vector<Ec*> acc(m * n);
+			std::vector<const Fp*> pts(m * n);
+			std::vector<Fp> prod(m * n);
+			Fp inv, di, lambda, t;
+			for (size_t w = 0; w < getWindowNum(t0.bitSize, t0.winSize); w++) {
+				size_t num = 0;
+				for (size_t i = 0; i < n; i++) {
+					const uint64_t d = t0.getDigit(s[i], w);
+					if (d == 0) continue;
+					for (size_t j = 0; j < m; j++) {
+						Ec& A = *z[j * n + i];
+						const Fp *xy = tbl[j]->data() + 2 * (w * tblNum + d - 1);
+						if (A.isZero()) {
+							A.x = xy[0];
+							A.y = xy[1];
+							A.z = 1;
+						} else if (A.x == xy[0]) { // A = +-P, not worth a special case of the batch
+							Ec T;
+							T.x = xy[0];
+							T.y = xy[1];
+							T.z = 1;
+							Ec::add(A, A, T);
+							A.normalize();
+						} else {
+							acc[num] = &A;
+							pts[num] = xy;
+							Fp::sub(di, xy[0], A.x);
+							if (num == 0) {
+								prod[0] = di;
+							} else {
+								Fp::mul(prod[num], prod[num - 1], di);
+							}
+							num++;
+						}
+					}
+				}
+				if (num == 0) continue;
+				Fp::inv(inv, prod[num - 1]);
+				for (size_t i = num; i > 0; i--) {
+					Ec& A = *acc[i - 1];
+					const Fp *xy = pts[i - 1];
+					Fp::sub(di, xy[0], A.x);
+					/* inv = 1 / (d_0 ... d_(i-1)) */
+					if (i > 1) {
+						Fp::mul(lambda, inv, prod[i - 2]);
+						Fp::mul(inv, inv, di);
+					} else {
+						lambda = inv;
+					}
+					/* lambda = (y_P - y_A) / (x_P - x_A), x = lambda^2 - x_A - x_P, y = lambda (x_A - x) - y_A */
+					Fp::sub(t, xy[1], A.y);
+					Fp::mul(lambda, lambda, t);
+					Fp::sqr(t, lambda);
+					Fp::sub(t, t, A.x);
+					Fp::sub(t, t, xy[0]);
+					Fp::sub(di, A.x, t);
+					A.x = t;
+					Fp::mul(di, di, lambda);
+					Fp::sub(A.y, di, A.y);
+				}
+			}
+		}
+	};
 	class PublicKey {
+	public:
+		typedef bool (*WindowProvider)(PublicKey& pub);
+	private:
 		size_t bitSize;
 		Ec f;
 		Ec g;
 		Ec h;
 		bool enableWindowMethod_;
-		fp::WindowMethod<Ec> wm_f;
-		fp::WindowMethod<Ec> wm_g;
-		fp::WindowMethod<Ec> wm_h;
+		WindowTable wm_f;
+		WindowTable wm_g;
+		WindowTable wm_h;
 		template<class N>
-		void mulDispatch(Ec& z, const Ec& x, const N& n, const fp::WindowMethod<Ec>& pw) const
+		void mulDispatch(Ec& z, const Ec& x, const N& n, const WindowTable& pw) const
 		{
 			if (enableWindowMethod_) {
 				pw.mul(z, n);
@@ -201,6 +750,73 @@ struct ElgamalT {
 		void mulG(Ec& z, const N& n) const { mulDispatch(z, g, n, wm_g); }
 		template<class N>
 		void mulH(Ec& z, const N& n) const { mulDispatch(z, h, n, wm_h); }
+		static WindowProvider& windowProvider()
+		{
+			static WindowProvider provider = 0;
+			return provider;
+		}
+		/*
+			batches of at least batchParallel().second ciphertexts are split over batchParallel().first threads
+		*/
+		static std::pair<size_t, size_t>& batchParallel()
+		{
+			static std::pair<size_t, size_t> param(1, 0);
+			return param;
+		}
+		/*
+			c[i] = (g^u[i], h^u[i] f^m[i]) for i in [0, n), without f^m[i] if m is null
+		*/
+		template<class N>
+		void encBatchRange(CipherText *c, const N *m, const Zn *u, size_t n) const
+		{
+			if (enableWindowMethod_) {
+				const WindowTable *tbl[] = { &wm_g, &wm_h };
+				std::vector<Ec*> z(2 * n);
+				for (size_t i = 0; i < n; i++) {
+					z[i] = &c[i].c1;
+					z[n + i] = &c[i].c2;
+				}
+				WindowTable::mulBatch(tbl, 2, z.data(), u, n);
+			} else {
+				for (size_t i = 0; i < n; i++) {
+					mulG(c[i].c1, u[i]);
+					mulH(c[i].c2, u[i]);
+				}
+			}
+			if (m == 0) return;
+			Ec t;
+			for (size_t i = 0; i < n; i++) {
+				mulF(t, m[i]);
+				Ec::add(c[i].c2, c[i].c2, t);
+			}
+		}
+		/*
+			encBatchRange in parallel, the randomness is drawn beforehand from rg in one thread
+		*/
+		template<class N>
+		void encBatchParallel(CipherText *c, const N *m, size_t n, fp::RandGen& rg) const
+		{
+			std::vector<Zn> u(n);
+			for (size_t i = 0; i < n; i++) {
+				u[i].setRand(rg);
+			}
+			const size_t threadNum = std::min(batchParallel().first, n);
+			if (threadNum <= 1 || batchParallel().second == 0 || n < batchParallel().second) {
+				encBatchRange(c, m, u.data(), n);
+				return;
+			}
+			std::vector<std::thread> threads;
+			for (size_t t = 1; t < threadNum; t++) {
+				const size_t begin = n * t / threadNum, end = n * (t + 1) / threadNum;
+				threads.push_back(std::thread([this, c, m, &u, begin, end]() {
+					encBatchRange(c + begin, m == 0 ? m : m + begin, &u[begin], end - begin);
+				}));
+			}
+			encBatchRange(c, m, u.data(), n / threadNum);
+			for (size_t t = 0; t < threads.size(); t++) {
+				threads[t].join();
+			}
+		}
 	public:
 		PublicKey()
 			: bitSize(0)
@@ -214,6 +830,30 @@ struct ElgamalT {
 			wm_h.init(h, bitSize, winSize);
 			enableWindowMethod_ = true;
 		}
+		/*
+			use tables of f, g, h built elsewhere, see WindowTable::attach
+		*/
+		void attachWindowTables(const typename Ec::Fp *tbl_f, const typename Ec::Fp *tbl_g, const typename Ec::Fp *tbl_h, size_t winSize,
+			const std::shared_ptr<const void>& owner = std::shared_ptr<const void>())
+		{
+			wm_f.attach(tbl_f, bitSize, winSize, owner);
+			wm_g.attach(tbl_g, bitSize, winSize, owner);
+			wm_h.attach(tbl_h, bitSize, winSize, owner);
+			enableWindowMethod_ = true;
+		}
+		const WindowTable& getWindowTableF() const { return wm_f; }
+		const WindowTable& getWindowTableG() const { return wm_g; }
+		const WindowTable& getWindowTableH() const { return wm_h; }
+		size_t getWindowMemoryByteSize() const
+		{
+			return wm_f.getMemoryByteSize() + wm_g.getMemoryByteSize() + wm_h.getMemoryByteSize();
+		}
+		size_t getBitSize() const { return bitSize; }
+		/*
+			init and load ask provider for the window tables of a key, e.g. from a cache,
+			and build them only if it returns false
+		*/
+		static void setWindowProvider(WindowProvider provider) { windowProvider() = provider; }
 		const Ec& getF() const { return f; }
 		void init(size_t bitSize, const Ec& f, const Ec& g, const Ec& h)
 		{
@@ -222,7 +862,9 @@ struct ElgamalT {
 			this->g = g;
 			this->h = h;
 			enableWindowMethod_ = false;
-			enableWindowMethod();
+			if (!windowProvider() || !windowProvider()(*this)) {
+				enableWindowMethod();
+			}
 		}
 		/*
 			encode message
@@ -249,6 +891,29 @@ struct ElgamalT {
 			mulG(c.c1, u);
 			mulH(c.c2, u);
 		}
+		/*
+			enc of m[0], ..., m[n - 1] into c[0], ..., c[n - 1], see WindowTable::mulBatch
+			m may be an array of Zn or of machine words, e.g. int
+		*/
+		template<class N>
+		void encBatch(CipherText *c, const N *m, size_t n, fp::RandGen rg = fp::RandGen()) const
+		{
+			encBatchParallel(c, m, n, rg);
+		}
+		/*
+			enc_off of c[0], ..., c[n - 1]
+		*/
+		void encOffBatch(CipherText *c, size_t n, fp::RandGen rg = fp::RandGen()) const
+		{
+			encBatchParallel(c, (const Zn*)0, n, rg);
+		}
+		/*
+			batches of at least minSize ciphertexts are split over threadNum threads (default : no threads)
+		*/
+		static void setBatchParallel(size_t threadNum, size_t minSize)
+		{
+			batchParallel() = std::make_pair(threadNum, minSize);
+		}
 		/*
 			encode message online part
 			input : m
@@ -491,10 +1156,173 @@ struct ElgamalT {
 			return cache.empty();
 		}
 	};
+	/*
+		baby-step giant-step table to find m in [rangeMin, rangeMax] such that f^m = g
+		baby steps f^j for 0 < j < babyNum are kept in an open-addressing table of
+		(fingerprint of x, j) next to the normalized points, f^j and f^-j have the same
+		x, so one entry serves both signs and a giant step is f^(2 babyNum - 1)
+		O(sqrt(rangeMax - rangeMin)) memory and additions per lookup
+		the table is not modified after init, so one table can be shared by threads
+	*/
+	class Bsgs {
+		struct Slot {
+			uint32_t tag;
+			int32_t j; // -1 if empty
+		};
+		std::vector<Slot> tbl;
+		std::vector<Ec> baby; // normalized f^j, baby[0] is zero
+		size_t mask;
+		Ec f;
+		Ec giant;
+		int64_t babyNum;
+		int64_t giantMin, giantMax; // f^m = giant^i f^j with |j| < babyNum for giantMin <= i <= giantMax
+		/*
+			P is normalized and not zero
+		*/
+		static uint64_t hashX(const Ec& P)
+		{
+			const fp::Unit *x = P.x.getUnit();
+			const size_t n = (Ec::Fp::getByteSize() + sizeof(fp::Unit) - 1) / sizeof(fp::Unit);
+			uint64_t h = 0;
+			for (size_t i = 0; i < n; i++) {
+				h = (h ^ (uint64_t)x[i]) * 0x9e3779b97f4a7c15ULL;
+			}
+			return h ^ (h >> 29);
+		}
+		static int64_t floorDiv(int64_t a, int64_t b)
+		{
+			return a >= 0 ? a / b : -((-a + b - 1) / b);
+		}
+		/*
+			return j in (-babyNum, babyNum) such that P = f^j if found
+		*/
+		bool findBaby(int64_t& j, const Ec& P) const
+		{
+			if (P.isZero()) {
+				j = 0;
+				return true;
+			}
+			const uint64_t h = hashX(P);
+			const uint32_t tag = uint32_t(h >> 32);
+			for (size_t i = size_t(h) & mask; tbl[i].j >= 0; i = (i + 1) & mask) {
+				if (tbl[i].tag != tag) continue;
+				/* x fingerprints may collide, so the match is checked on x and the sign on y */
+				const Ec& fj = baby[tbl[i].j];
+				if (fj.x != P.x) continue;
+				j = fj.y == P.y ? tbl[i].j : -int64_t(tbl[i].j);
+				return true;
+			}
+			return false;
+		}
+	public:
+		Bsgs() : mask(0), babyNum(0), giantMin(0), giantMax(-1) {}
+		void init(const Ec& f, int rangeMin, int rangeMax)
+		{
+			if (rangeMin > rangeMax) throw cybozu::Exception("mcl:ElgamalT:Bsgs:bad range") << rangeMin << rangeMax;
+			this->f = f;
+			const int64_t width = int64_t(rangeMax) - rangeMin + 1;
+			babyNum = 1;
+			while (2 * babyNum * babyNum < width) babyNum++;
+			babyNum++;
+			size_t n = 2;
+			while (n < size_t(2 * babyNum)) n *= 2; // load factor <= 1/2
+			Slot empty = { 0, -1 };
+			tbl.assign(n, empty);
+			mask = n - 1;
+			baby.resize((size_t)babyNum);
+			std::vector<Ec*> pBaby((size_t)babyNum);
+			baby[0].clear();
+			pBaby[0] = &baby[0];
+			for (int64_t j = 1; j < babyNum; j++) {
+				Ec::add(baby[j], baby[j - 1], f);
+				pBaby[j] = &baby[j];
+			}
+			normalizePoints(pBaby.data(), pBaby.size());
+			for (int64_t j = 1; j < babyNum; j++) {
+				const uint64_t h = hashX(baby[j]);
+				size_t i = size_t(h) & mask;
+				while (tbl[i].j >= 0) i = (i + 1) & mask;
+				tbl[i].tag = uint32_t(h >> 32);
+				tbl[i].j = int32_t(j);
+			}
+			const int64_t step = 2 * babyNum - 1;
+			Ec::mul(giant, f, step);
+			giantMin = -floorDiv(babyNum - 1 - int64_t(rangeMin), step);
+			giantMax = floorDiv(int64_t(rangeMax) + babyNum - 1, step);
+		}
+		/*
+			return m such that f^m = g
+		*/
+		int getExponent(const Ec& g, bool *b = 0) const
+		{
+			const int64_t step = 2 * babyNum - 1;
+			/* giant steps are normalized in batches of up to batchNum points */
+			const int64_t batchNum = 64;
+			Ec t[batchNum];
+			Ec *pt[batchNum];
+			Ec::mul(t[0], giant, giantMin);
+			Ec::sub(t[0], g, t[0]);
+			for (int64_t i = giantMin; i <= giantMax; i += batchNum) {
+				const int64_t n = std::min(batchNum, giantMax - i + 1);
+				for (int64_t k = 0; k < n; k++) {
+					if (k > 0) Ec::sub(t[k], t[k - 1], giant);
+					pt[k] = &t[k];
+				}
+				normalizePoints(pt, size_t(n));
+				for (int64_t k = 0; k < n; k++) {
+					int64_t j;
+					if (findBaby(j, t[k])) {
+						if (b) *b = true;
+						return int((i + k) * step + j);
+					}
+				}
+				Ec::sub(t[0], t[n - 1], giant);
+			}
+			if (b) {
+				*b = false;
+				return 0;
+			}
+			throw cybozu::Exception("Elgamal:Bsgs:getExponent:not found") << g;
+		}
+		void clear()
+		{
+			tbl.clear();
+			baby.clear();
+			mask = 0;
+			babyNum = 0;
+			giantMin = 0;
+			giantMax = -1;
+		}
+		bool isEmpty() const
+		{
+			return tbl.empty();
+		}
+	};
 	class PrivateKey {
 		PublicKey pub;
 		Zn z;
 		PowerCache cache;
+		/*
+			regular digits of z, recoded once whenever z is set, see initDigits
+		*/
+		std::vector<int8_t> zDigits;
+		void initDigits()
+		{
+			mpz_class k, n;
+			z.getMpz(k);
+			std::string str;
+			Zn::getModulo(str);
+			gmp::setStr(n, str, 10);
+			recodeRegular(zDigits, k, n);
+		}
+		/*
+			x = P^z with the precomputed digits of z, in constant time, see mulRegular
+			no scratch is kept in the key, so one key can be used by threads
+		*/
+		void mulZ(Ec& x, const Ec& P) const
+		{
+			mulRegular(x, P, zDigits);
+		}
 	public:
 		/*
 			init
@@ -512,6 +1340,7 @@ struct ElgamalT {
 			z.setRand(rg);
 			Ec::mul(h, g, z);
 			pub.init(bitSize, f, g, h);
+			initDigits();
 		}
 		const PublicKey& getPublicKey() const { return pub; }
 		/*
@@ -526,7 +1355,7 @@ struct ElgamalT {
 		{
 			const Ec& f = pub.getF();
 			Ec c1z;
-			Ec::mul(c1z, c.c1, z);
+			mulZ(c1z, c.c1);
 			if (c1z == c.c2) {
 				m = 0;
 				return;
@@ -553,7 +1382,7 @@ struct ElgamalT {
 		void getPowerf(Ec& powfm, const CipherText& c) const
 		{
 			Ec c1z;
-			Ec::mul(c1z, c.c1, z);
+			mulZ(c1z, c.c1);
 			Ec::sub(powfm, c.c2, c1z);
 		}
 		/*
@@ -583,20 +1412,60 @@ struct ElgamalT {
 			getPowerf(powfm, c);
 			return cache.getExponent(powfm, b);
 		}
+		/*
+			decode message by baby-step giant-step table bsgs of f
+			input : c = (c1, c2)
+			        b : set false if not found
+			return m
+		*/
+		int dec(const CipherText& c, const Bsgs& bsgs, bool *b = 0) const
+		{
+			Ec powfm;
+			getPowerf(powfm, c);
+			return bsgs.getExponent(powfm, b);
+		}
+		void dec(Zn& m, const CipherText& c, const Bsgs& bsgs) const
+		{
+			m = dec(c, bsgs);
+		}
 		/*
 			check whether c is encrypted zero message
 		*/
 		bool isZeroMessage(const CipherText& c) const
 		{
 			Ec c1z;
-			Ec::mul(c1z, c.c1, z);
+			mulZ(c1z, c.c1);
 			return c.c2 == c1z;
 		}
+		/*
+			return the index of the first of c[0], ..., c[n - 1] that encrypts zero, n if there is none
+			all n are tested, c1^z of all of them are normalized with one inversion
+		*/
+		size_t findZeroMessage(const CipherText *c, size_t n) const
+		{
+			std::vector<Ec> c1z(n);
+			std::vector<Ec*> P(n);
+			for (size_t i = 0; i < n; i++) {
+				mulZ(c1z[i], c[i].c1);
+				P[i] = &c1z[i];
+			}
+			normalizePoints(P.data(), n);
+			size_t found = n;
+			for (size_t i = n; i > 0; i--) {
+				if (c[i - 1].c2 == c1z[i - 1]) found = i - 1;
+			}
+			return found;
+		}
+		size_t findZeroMessage(const std::vector<CipherText>& c) const
+		{
+			return c.empty() ? 0 : findZeroMessage(&c[0], c.size());
+		}
 		template<class InputStream>
 		void load(InputStream& is, int ioMode = IoSerialize)
 		{
 			pub.load(is, ioMode);
 			z.load(is, ioMode);
+			initDigits();
 		}
 		template<class OutputStream>
 		void save(OutputStream& os, int ioMode = IoSerialize) const